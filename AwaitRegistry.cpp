@@ -0,0 +1,328 @@
+#include "AwaitRegistry.h"
+
+#include <algorithm>
+
+UINT64 AwaitRegistry::awaitRecord(RecordMatcher match, DWORD timeout, AwaitCompletion completion)
+{
+	std::unique_ptr<Waiter> waiter(new Waiter());
+	waiter->kind = WaitKind::Record;
+	waiter->match = std::move(match);
+	waiter->completion = std::move(completion);
+
+	return add(std::move(waiter), timeout);
+}
+
+UINT64 AwaitRegistry::awaitBytes(USHORT device, UCHAR endpoint, size_t bytes, DWORD timeout, AwaitCompletion completion)
+{
+	std::unique_ptr<Waiter> waiter(new Waiter());
+	waiter->kind = WaitKind::Bytes;
+	waiter->device = device;
+	waiter->endpoint = endpoint;
+	waiter->bytes = bytes;
+	waiter->completion = std::move(completion);
+
+	return add(std::move(waiter), timeout);
+}
+
+UINT64 AwaitRegistry::awaitControl(int device, DWORD timeout, AwaitCompletion completion)
+{
+	std::unique_ptr<Waiter> waiter(new Waiter());
+	waiter->kind = WaitKind::Control;
+	waiter->device = device;
+	waiter->completion = std::move(completion);
+
+	return add(std::move(waiter), timeout);
+}
+
+bool AwaitRegistry::cancel(UINT64 id)
+{
+	std::vector<std::unique_ptr<Waiter>> done;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto it = std::find_if(waiters.begin(), waiters.end(), [id](const std::unique_ptr<Waiter>& waiter) { return waiter->id == id; });
+		if (it == waiters.end())
+		{
+			return false;
+		}
+
+		(*it)->result.status = AwaitStatus::Stopped;
+		done.push_back(std::move(*it));
+
+		waiters.erase(it);
+		count = waiters.size();
+	}
+
+	complete(done);
+	return true;
+}
+
+void AwaitRegistry::setClock(Clock* clock)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->clock = clock;
+}
+
+void AwaitRegistry::setExecutor(AwaitExecutor executor)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->executor = std::move(executor);
+}
+
+void AwaitRegistry::setWakeup(std::function<void()> wakeup)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->wakeup = std::move(wakeup);
+}
+
+void AwaitRegistry::open()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	opened = true;
+}
+
+void AwaitRegistry::close()
+{
+	std::vector<std::unique_ptr<Waiter>> done;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		opened = false;
+
+		for (auto& waiter : waiters)
+		{
+			waiter->result.status = AwaitStatus::Stopped;
+			done.push_back(std::move(waiter));
+		}
+
+		waiters.clear();
+		count = 0;
+	}
+
+	complete(done);
+}
+
+void AwaitRegistry::dispatch(const RecordBatch& batch)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	std::vector<std::unique_ptr<Waiter>> done;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		for (size_t i = 0; i < batch.count && waiters.empty() == false; i++)
+		{
+			const CaptureRecord& record = batch.records[i];
+
+			for (size_t n = 0; n < waiters.size();)
+			{
+				if (matches(*waiters[n], record, batch.buffer))
+				{
+					waiters[n]->result.status = AwaitStatus::Completed;
+					done.push_back(std::move(waiters[n]));
+
+					waiters.erase(waiters.begin() + n);
+					continue;
+				}
+
+				n++;
+			}
+		}
+
+		count = waiters.size();
+	}
+
+	complete(done);
+}
+
+void AwaitRegistry::expire()
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	std::vector<std::unique_ptr<Waiter>> done;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		UINT64 now = clock->now();
+
+		for (size_t n = 0; n < waiters.size();)
+		{
+			if (waiters[n]->deadline != 0 && waiters[n]->deadline <= now)
+			{
+				waiters[n]->result.status = AwaitStatus::TimedOut;
+				done.push_back(std::move(waiters[n]));
+
+				waiters.erase(waiters.begin() + n);
+				continue;
+			}
+
+			n++;
+		}
+
+		count = waiters.size();
+	}
+
+	complete(done);
+}
+
+DWORD AwaitRegistry::nextTimeout()
+{
+	if (count == 0)
+	{
+		return INFINITE;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	UINT64 deadline = 0;
+
+	for (auto& waiter : waiters)
+	{
+		if (waiter->deadline != 0 && (deadline == 0 || waiter->deadline < deadline))
+		{
+			deadline = waiter->deadline;
+		}
+	}
+
+	if (deadline == 0)
+	{
+		return INFINITE;
+	}
+
+	UINT64 now = clock->now();
+	if (deadline <= now)
+	{
+		return 0;
+	}
+
+	// round up, waking early would only spin once more
+	return (DWORD)std::min<UINT64>((deadline - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC, INFINITE - 1);
+}
+
+UINT64 AwaitRegistry::add(std::unique_ptr<Waiter> waiter, DWORD timeout)
+{
+	std::function<void()> notify;
+	UINT64 id;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		if (opened == false)
+		{
+			return 0;
+		}
+
+		id = nextId++;
+
+		waiter->id = id;
+		waiter->deadline = (timeout == INFINITE) ? 0 : clock->now() + (UINT64)timeout * NSEC_PER_MSEC;
+		waiter->result.status = AwaitStatus::Stopped;
+
+		waiters.push_back(std::move(waiter));
+		count = waiters.size();
+
+		notify = wakeup;
+	}
+
+	if (notify)
+	{
+		notify();
+	}
+
+	return id;
+}
+
+bool AwaitRegistry::matches(Waiter& waiter, const CaptureRecord& record, const unsigned char* buffer)
+{
+	const unsigned char* payload = &buffer[record.payloadOffset];
+
+	switch (waiter.kind)
+	{
+	case WaitKind::Record:
+		if (waiter.match(record, payload) == false)
+		{
+			return false;
+		}
+
+		waiter.result.record = record;
+		waiter.result.data.assign(payload, payload + record.payloadLength);
+		return true;
+
+	case WaitKind::Bytes:
+		if (record.header.device != waiter.device || record.header.endpoint != waiter.endpoint ||
+			record.header.transfer == USBPCAP_TRANSFER_CONTROL || record.payloadLength == 0)
+		{
+			return false;
+		}
+
+		waiter.result.record = record;
+		waiter.result.data.insert(waiter.result.data.end(), payload, payload + record.payloadLength);
+		return waiter.result.data.size() >= waiter.bytes;
+
+	case WaitKind::Control:
+	{
+		if (record.header.transfer != USBPCAP_TRANSFER_CONTROL || (record.header.info & USBPCAP_INFO_PDO_TO_FDO) == 0 ||
+			(waiter.device >= 0 && record.header.device != waiter.device) ||
+			record.header.headerLen < sizeof(USBPCAP_BUFFER_CONTROL_HEADER))
+		{
+			return false;
+		}
+
+		UCHAR stage = buffer[record.offset + sizeof(pcaprec_hdr_t) + sizeof(USBPCAP_BUFFER_PACKET_HEADER)];
+		if (stage != USBPCAP_CONTROL_STAGE_STATUS && stage != USBPCAP_CONTROL_STAGE_COMPLETE)
+		{
+			return false;
+		}
+
+		waiter.result.record = record;
+		waiter.result.data.assign(payload, payload + record.payloadLength);
+		return true;
+	}
+	}
+
+	return false;
+}
+
+void AwaitRegistry::complete(std::vector<std::unique_ptr<Waiter>>& done)
+{
+	if (done.empty())
+	{
+		return;
+	}
+
+	AwaitExecutor post;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		post = executor;
+	}
+
+	// completions run unlocked, they may register the next wait right away
+	for (auto& waiter : done)
+	{
+		if (post)
+		{
+			std::shared_ptr<Waiter> task(std::move(waiter));
+			post([task]() { task->completion(std::move(task->result)); });
+		}
+		else
+		{
+			waiter->completion(std::move(waiter->result));
+		}
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CaptureRecord.h"
+#include "Timestamp.h"
+
+enum class AwaitStatus
+{
+	Completed,
+	TimedOut,
+	Stopped,  // capture stopped or waiter cancelled
+};
+
+struct AwaitResult
+{
+	AwaitStatus status;
+	CaptureRecord record;            // last record taking part in the result
+	std::vector<unsigned char> data; // copied payload, read buffers are reused
+};
+
+typedef std::function<bool(const CaptureRecord& record, const unsigned char* payload)> RecordMatcher;
+typedef std::function<void(AwaitResult&& result)> AwaitCompletion;
+typedef std::function<void(std::function<void()>&& task)> AwaitExecutor;
+
+// One-shot waits on captured traffic. The reader thread matches every batch
+// against the registered waiters and completes them in place, or through the
+// executor when one is set. Timeouts are in ms, INFINITE waits forever.
+//
+// Registration returns 0 without calling the completion while the registry
+// is closed, i.e. capture is not running.
+class AwaitRegistry
+{
+public:
+	AwaitRegistry() = default;
+
+	AwaitRegistry(const AwaitRegistry&) = delete;
+	AwaitRegistry& operator=(const AwaitRegistry&) = delete;
+
+public:
+	// next record accepted by match
+	UINT64 awaitRecord(RecordMatcher match, DWORD timeout, AwaitCompletion completion);
+	// at least bytes of payload from an endpoint, gathered over several records
+	UINT64 awaitBytes(USHORT device, UCHAR endpoint, size_t bytes, DWORD timeout, AwaitCompletion completion);
+	// completion of the next control transfer of a device, device of -1 matches all
+	UINT64 awaitControl(int device, DWORD timeout, AwaitCompletion completion);
+
+	bool cancel(UINT64 id);
+
+	void setClock(Clock* clock);
+	void setExecutor(AwaitExecutor executor);
+	// Called after registration so the reader can shorten its wait.
+	void setWakeup(std::function<void()> wakeup);
+
+	void open();
+	// Completes all waiters with AwaitStatus::Stopped.
+	void close();
+
+	// Reader side
+	void dispatch(const RecordBatch& batch);
+	void expire();
+	DWORD nextTimeout();
+
+private:
+	enum class WaitKind
+	{
+		Record,
+		Bytes,
+		Control,
+	};
+
+	struct Waiter
+	{
+		UINT64 id;
+		WaitKind kind;
+
+		RecordMatcher match;
+		int device;
+		int endpoint;
+		size_t bytes;
+
+		UINT64 deadline; // 0 without timeout
+		AwaitCompletion completion;
+		AwaitResult result;
+	};
+
+	UINT64 add(std::unique_ptr<Waiter> waiter, DWORD timeout);
+	bool matches(Waiter& waiter, const CaptureRecord& record, const unsigned char* buffer);
+	void complete(std::vector<std::unique_ptr<Waiter>>& done);
+
+private:
+	std::mutex lock;
+	std::vector<std::unique_ptr<Waiter>> waiters;
+	std::atomic<size_t> count{ 0 };
+
+	UINT64 nextId = 1;
+	bool opened = false;
+
+	Clock* clock = &MonotonicClock::instance();
+	AwaitExecutor executor;
+	std::function<void()> wakeup;
+
+};
@@ -0,0 +1,172 @@
+#include "BatchQueue.h"
+
+#include <chrono>
+
+BatchQueue::~BatchQueue()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// outstanding batches must have been released by now
+	for (auto batch : pending)
+	{
+		pool->release(batch->buffer);
+		delete batch;
+	}
+
+	for (auto batch : spare)
+	{
+		delete batch;
+	}
+}
+
+void BatchQueue::configure(BufferPool* pool, size_t depth)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->pool = pool;
+	this->depth = (depth == 0) ? 1 : depth;
+}
+
+void BatchQueue::open()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	closed = false;
+}
+
+void BatchQueue::close()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		closed = true;
+	}
+
+	queueChanged.notify_all();
+}
+
+bool BatchQueue::push(CaptureBuffer* buffer, DWORD bytes, std::vector<CaptureRecord>& records)
+{
+	PulledBatch* batch;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		// nobody pops after close, the buffer would only be held back
+		if (closed)
+		{
+			return false;
+		}
+
+		if (pending.size() >= depth)
+		{
+			stats.dropped++;
+			return false;
+		}
+
+		if (spare.empty())
+		{
+			batch = new PulledBatch();
+		}
+		else
+		{
+			batch = spare.back();
+			spare.pop_back();
+		}
+	}
+
+	pool->retain(buffer);
+	buffer->length = bytes;
+
+	batch->buffer = buffer;
+	batch->records.swap(records);
+
+	batch->batch.buffer = buffer->data;
+	batch->batch.bytes = bytes;
+	batch->batch.records = batch->records.data();
+	batch->batch.count = batch->records.size();
+	batch->batch.arrival = batch->records.empty() ? 0 : batch->records.front().arrival;
+	batch->batch.index = nullptr;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		if (closed)
+		{
+			records.swap(batch->records);
+			spare.push_back(batch);
+		}
+		else
+		{
+			pending.push_back(batch);
+			stats.queued++;
+			batch = nullptr;
+		}
+	}
+
+	// closed while the batch was filled in
+	if (batch != nullptr)
+	{
+		pool->release(buffer);
+		return false;
+	}
+
+	queueChanged.notify_one();
+	return true;
+}
+
+PulledBatch* BatchQueue::pop(DWORD timeout)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	auto ready = [this]() { return pending.empty() == false || closed; };
+
+	if (timeout == INFINITE)
+	{
+		queueChanged.wait(guard, ready);
+	}
+	else if (queueChanged.wait_for(guard, std::chrono::milliseconds(timeout), ready) == false)
+	{
+		return nullptr;
+	}
+
+	if (pending.empty())
+	{
+		return nullptr;
+	}
+
+	PulledBatch* batch = pending.front();
+	pending.pop_front();
+
+	stats.pulled++;
+	stats.outstanding++;
+
+	return batch;
+}
+
+void BatchQueue::release(PulledBatch* batch)
+{
+	if (batch == nullptr)
+	{
+		return;
+	}
+
+	pool->release(batch->buffer);
+	batch->buffer = nullptr;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	// record vector keeps its capacity for the next batch
+	spare.push_back(batch);
+	stats.outstanding--;
+}
+
+BatchQueueStats BatchQueue::getStats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	BatchQueueStats current = stats;
+	current.pending = pending.size();
+
+	return current;
+}
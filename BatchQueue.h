@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "BufferPool.h"
+#include "CaptureRecord.h"
+
+#define DEFAULT_PULL_QUEUE_DEPTH 8
+
+// Read buffer handed to a pulling consumer. Records and payloads point into
+// the driver's read buffer, which stays untouched until releaseBatch().
+class PulledBatch
+{
+public:
+	const CaptureRecord* begin() const
+	{
+		return batch.records;
+	}
+
+	const CaptureRecord* end() const
+	{
+		return batch.records + batch.count;
+	}
+
+	size_t size() const
+	{
+		return batch.count;
+	}
+
+	const unsigned char* payload(const CaptureRecord& record) const
+	{
+		return &batch.buffer[record.payloadOffset];
+	}
+
+public:
+	RecordBatch batch;
+
+private:
+	friend class BatchQueue;
+
+	CaptureBuffer* buffer = nullptr;
+	std::vector<CaptureRecord> records;
+};
+
+struct BatchQueueStats
+{
+	UINT64 queued;
+	UINT64 pulled;
+	UINT64 dropped;     // batches not queued because the consumer fell behind
+	size_t pending;     // queued, not pulled yet
+	size_t outstanding; // pulled, not released yet
+};
+
+// Bounded hand-off of read buffers from the reader thread to a consumer
+// pulling at its own pace. Buffers come from and go back to the BufferPool.
+class BatchQueue
+{
+public:
+	BatchQueue() = default;
+	~BatchQueue();
+
+	BatchQueue(const BatchQueue&) = delete;
+	BatchQueue& operator=(const BatchQueue&) = delete;
+
+public:
+	void configure(BufferPool* pool, size_t depth);
+	void open();
+	// Wakes waiting consumers, batches already queued can still be pulled.
+	void close();
+
+	// Retains the buffer and swaps the records out on success, fails once closed.
+	bool push(CaptureBuffer* buffer, DWORD bytes, std::vector<CaptureRecord>& records);
+
+	// Returns nullptr on timeout or when closed and drained.
+	PulledBatch* pop(DWORD timeout);
+	void release(PulledBatch* batch);
+
+	BatchQueueStats getStats();
+
+private:
+	std::mutex lock;
+	std::condition_variable queueChanged;
+
+	BufferPool* pool = nullptr;
+	size_t depth = DEFAULT_PULL_QUEUE_DEPTH;
+	bool closed = true;
+
+	std::deque<PulledBatch*> pending;
+	std::vector<PulledBatch*> spare;
+	BatchQueueStats stats = {};
+
+};
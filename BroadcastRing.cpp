@@ -0,0 +1,301 @@
+#include "BroadcastRing.h"
+
+BroadcastRing::~BroadcastRing()
+{
+	close();
+	join();
+
+	// detached consumers still read the slots, a handler can't wait for itself
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [this]() { return hasActiveConsumers(std::this_thread::get_id()) == false; });
+}
+
+void BroadcastRing::configure(BufferPool* pool, size_t slots, BroadcastOverflow overflow)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	size_t count = 1;
+	while (count < slots)
+	{
+		count <<= 1;
+	}
+
+	this->pool = pool;
+	this->overflow = overflow;
+	this->slots.resize(count);
+}
+
+size_t BroadcastRing::addConsumer(BatchHandler handler, const ThreadOptions& options)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::unique_ptr<Consumer> consumer(new Consumer());
+	consumer->handler = std::move(handler);
+	consumer->options = options;
+
+	if (consumer->options.name.empty())
+	{
+		consumer->options.name = "USBPcap consumer";
+	}
+
+	consumers.push_back(std::move(consumer));
+	return consumers.size() - 1;
+}
+
+bool BroadcastRing::hasConsumers()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return consumers.empty() == false;
+}
+
+bool BroadcastRing::start()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (pool == nullptr || slots.empty())
+	{
+		fprintf(stderr, "Broadcast ring is not configured\n");
+		return false;
+	}
+
+	// a second thread would handle the same consumer, even if called from that handler
+	if (hasActiveConsumers())
+	{
+		fprintf(stderr, "Broadcast consumer from the previous capture is still running\n");
+		return false;
+	}
+
+	closed = false;
+
+	// sequences keep counting across restarts, new cursors start at the end
+	for (auto& consumer : consumers)
+	{
+		consumer->cursor = sequence;
+		consumer->active = true;
+		consumer->thread = std::thread(&BroadcastRing::consume, this, consumer.get());
+		consumer->id = consumer->thread.get_id();
+	}
+
+	return true;
+}
+
+void BroadcastRing::close()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		closed = true;
+	}
+
+	published.notify_all();
+	spaceFreed.notify_all();
+}
+
+void BroadcastRing::join()
+{
+	for (auto& consumer : consumers)
+	{
+		if (consumer->thread.joinable() == false)
+		{
+			continue;
+		}
+
+		// a handler may stop the capture from its own thread
+		if (consumer->thread.get_id() == std::this_thread::get_id())
+		{
+			consumer->thread.detach();
+			continue;
+		}
+
+		consumer->thread.join();
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	// everything once all consumers are done, a detached handler keeps its slot
+	if (pool != nullptr && slots.empty() == false)
+	{
+		releasePassed(minimumCursor());
+	}
+}
+
+bool BroadcastRing::publish(CaptureBuffer* buffer, DWORD bytes, std::vector<CaptureRecord>& records)
+{
+	{
+		std::unique_lock<std::mutex> guard(lock);
+
+		if (closed)
+		{
+			return false;
+		}
+
+		UINT64 minimum = minimumCursor();
+		releasePassed(minimum);
+
+		if (sequence - minimum >= slots.size())
+		{
+			if (overflow == BroadcastOverflow::Drop)
+			{
+				stats.dropped++;
+				return false;
+			}
+
+			stats.blocked++;
+			spaceFreed.wait(guard, [this]() { return sequence - minimumCursor() < slots.size() || closed; });
+
+			if (closed)
+			{
+				return false;
+			}
+
+			releasePassed(minimumCursor());
+		}
+
+		// no consumer reads this slot before sequence moves past it
+		Slot& slot = slots[sequence & (slots.size() - 1)];
+
+		pool->retain(buffer);
+		buffer->length = bytes;
+
+		slot.buffer = buffer;
+		slot.records.swap(records);
+
+		slot.batch.buffer = buffer->data;
+		slot.batch.bytes = bytes;
+		slot.batch.records = slot.records.data();
+		slot.batch.count = slot.records.size();
+		slot.batch.arrival = slot.records.empty() ? 0 : slot.records.front().arrival;
+		slot.batch.index = nullptr;
+
+		sequence++;
+		stats.published++;
+	}
+
+	published.notify_all();
+	return true;
+}
+
+BroadcastStats BroadcastRing::getStats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
+
+bool BroadcastRing::isConsumerThread()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (auto& consumer : consumers)
+	{
+		if (consumer->active && consumer->id == std::this_thread::get_id())
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// After join() only detached consumers are still active.
+bool BroadcastRing::hasActiveConsumers(std::thread::id ignored)
+{
+	for (auto& consumer : consumers)
+	{
+		if (consumer->active && consumer->id != ignored)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+UINT64 BroadcastRing::getLag(size_t consumer)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (consumer >= consumers.size())
+	{
+		return 0;
+	}
+
+	return sequence - consumers[consumer]->cursor.load(std::memory_order_acquire);
+}
+
+void BroadcastRing::consume(Consumer* consumer)
+{
+	HANDLE mmcssHandle = applyThreadOptions(consumer->options);
+	UINT64 next = consumer->cursor.load(std::memory_order_relaxed);
+
+	while (true)
+	{
+		UINT64 available;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+
+			published.wait(guard, [this, next]() { return sequence > next || closed; });
+
+			// drained after close
+			if (sequence <= next)
+			{
+				break;
+			}
+
+			available = sequence;
+		}
+
+		// slots up to available are not touched until this cursor passes them
+		for (; next < available; next++)
+		{
+			consumer->handler(slots[next & (slots.size() - 1)].batch);
+			consumer->cursor.store(next + 1, std::memory_order_release);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			// the last consumer past a slot hands its buffer back, the reader may be idle
+			releasePassed(minimumCursor());
+		}
+
+		spaceFreed.notify_one();
+	}
+
+	revertThreadOptions(mmcssHandle);
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	// notified under the lock, the ring may be destroyed once it is released
+	consumer->active = false;
+	finished.notify_all();
+}
+
+UINT64 BroadcastRing::minimumCursor()
+{
+	UINT64 minimum = sequence;
+
+	for (auto& consumer : consumers)
+	{
+		UINT64 cursor = consumer->cursor.load(std::memory_order_acquire);
+		if (cursor < minimum)
+		{
+			minimum = cursor;
+		}
+	}
+
+	return minimum;
+}
+
+void BroadcastRing::releasePassed(UINT64 minimum)
+{
+	for (; released < minimum; released++)
+	{
+		Slot& slot = slots[released & (slots.size() - 1)];
+
+		pool->release(slot.buffer);
+		slot.buffer = nullptr;
+	}
+}
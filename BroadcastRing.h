@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BufferPool.h"
+#include "CaptureRecord.h"
+#include "ThreadOptions.h"
+
+#define DEFAULT_BROADCAST_SLOTS 16
+
+// What publish() does when the slowest consumer is a whole ring behind.
+enum class BroadcastOverflow
+{
+	Drop,  // the batch is not published, the reader never waits
+	Block, // the reader waits for the slowest consumer, see USBPcapHelper::setBroadcastOptions()
+};
+
+typedef std::function<void(const RecordBatch& batch)> BatchHandler;
+
+struct BroadcastStats
+{
+	UINT64 published;
+	UINT64 dropped; // batches not published because the ring was full
+	UINT64 blocked; // times publish() had to wait
+};
+
+// Disruptor-style fan-out of read buffers to consumers running on their own
+// threads. Every consumer sees every published batch in order and keeps its
+// own sequence cursor. A slot and its read buffer go back to the BufferPool
+// only once all cursors have passed it.
+class BroadcastRing
+{
+public:
+	BroadcastRing() = default;
+	~BroadcastRing();
+
+	BroadcastRing(const BroadcastRing&) = delete;
+	BroadcastRing& operator=(const BroadcastRing&) = delete;
+
+public:
+	// slots is rounded up to a power of two
+	void configure(BufferPool* pool, size_t slots = DEFAULT_BROADCAST_SLOTS, BroadcastOverflow overflow = BroadcastOverflow::Drop);
+	// Consumers are added while stopped, returns the consumer's index.
+	size_t addConsumer(BatchHandler handler, const ThreadOptions& options = ThreadOptions());
+	bool hasConsumers();
+
+	// Fails while a consumer that stopped the capture from its own handler is still running.
+	bool start();
+	// No further batches are published, consumers drain what is left.
+	void close();
+	// Waits for consumers and returns all buffers to the pool. Called from a
+	// consumer's handler, that consumer is detached and finishes on its own.
+	void join();
+
+	// Retains the buffer and swaps the records out on success.
+	bool publish(CaptureBuffer* buffer, DWORD bytes, std::vector<CaptureRecord>& records);
+
+	bool isConsumerThread();
+
+	BroadcastStats getStats();
+	// batches published but not yet handled by a consumer
+	UINT64 getLag(size_t consumer);
+
+private:
+	struct Slot
+	{
+		CaptureBuffer* buffer = nullptr;
+		std::vector<CaptureRecord> records;
+		RecordBatch batch;
+	};
+
+	struct Consumer
+	{
+		BatchHandler handler;
+		ThreadOptions options;
+
+		std::atomic<UINT64> cursor{ 0 }; // next sequence to handle
+		std::thread thread;
+		std::thread::id id; // kept when detached
+		bool active = false; // under lock, until consume() returns
+	};
+
+	void consume(Consumer* consumer);
+	bool hasActiveConsumers(std::thread::id ignored = std::thread::id());
+	UINT64 minimumCursor();
+	void releasePassed(UINT64 minimum);
+
+private:
+	std::mutex lock;
+	std::condition_variable published;   // consumers wait for batches
+	std::condition_variable spaceFreed;  // publish() waits for slots
+	std::condition_variable finished;    // the destructor waits for detached consumers
+
+	BufferPool* pool = nullptr;
+	BroadcastOverflow overflow = BroadcastOverflow::Drop;
+	std::vector<Slot> slots;
+
+	std::vector<std::unique_ptr<Consumer>> consumers;
+
+	UINT64 sequence = 0; // batches published
+	UINT64 released = 0; // slots before this went back to the pool
+	bool closed = true;
+
+	BroadcastStats stats = {};
+
+};
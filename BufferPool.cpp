@@ -0,0 +1,326 @@
+#include "BufferPool.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+BufferPool::BufferPool(DWORD bufferSize, unsigned int flags)
+{
+	configure(bufferSize, flags);
+}
+
+BufferPool::~BufferPool()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (stats.inUse > 0)
+	{
+		fprintf(stderr, "BufferPool destroyed with %zu buffers in use\n", stats.inUse);
+	}
+
+	// retained ones included, their owners must not outlive the pool
+	while (buffers.empty() == false)
+	{
+		destroy(buffers.back());
+	}
+	freeBuffers.clear();
+}
+
+bool BufferPool::configure(DWORD bufferSize, unsigned int flags)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (this->bufferSize == bufferSize && this->flags == flags)
+	{
+		return true;
+	}
+
+	if (stats.inUse > 0)
+	{
+		fprintf(stderr, "BufferPool cannot be reconfigured while buffers are in use\n");
+		return false;
+	}
+
+	for (auto buffer : freeBuffers)
+	{
+		destroy(buffer);
+	}
+	freeBuffers.clear();
+
+	this->bufferSize = bufferSize;
+	this->flags = flags;
+
+	return true;
+}
+
+bool BufferPool::reserve(size_t count)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	while (freeBuffers.size() < count)
+	{
+		CaptureBuffer* buffer = allocate();
+		if (buffer == nullptr)
+		{
+			return false;
+		}
+
+		freeBuffers.push_back(buffer);
+	}
+
+	return true;
+}
+
+CaptureBuffer* BufferPool::acquire()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	CaptureBuffer* buffer;
+
+	if (freeBuffers.empty() == false)
+	{
+		buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+
+		stats.reused++;
+	}
+	else
+	{
+		buffer = allocate();
+		if (buffer == nullptr)
+		{
+			return nullptr;
+		}
+	}
+
+	buffer->length = 0;
+	buffer->references = 1;
+
+	stats.acquired++;
+	stats.inUse++;
+	if (stats.inUse > stats.peakInUse)
+	{
+		stats.peakInUse = stats.inUse;
+	}
+
+	return buffer;
+}
+
+void BufferPool::retain(CaptureBuffer* buffer)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	buffer->references++;
+}
+
+void BufferPool::release(CaptureBuffer* buffer)
+{
+	if (buffer == nullptr)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (--buffer->references > 0)
+	{
+		return;
+	}
+
+	stats.inUse--;
+
+	if (buffer->capacity != bufferSize || buffer->flags != flags)
+	{
+		// allocated before configure() changed the size or the flags
+		destroy(buffer);
+		return;
+	}
+
+	freeBuffers.push_back(buffer);
+}
+
+DWORD BufferPool::getBufferSize()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return bufferSize;
+}
+
+BufferPoolStats BufferPool::getStats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
+
+CaptureBuffer* BufferPool::allocate()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	SIZE_T pageSize = info.dwPageSize;
+	SIZE_T size = ((SIZE_T)bufferSize + pageSize - 1) & ~(pageSize - 1);
+	bool largePages = false;
+	void* memory = nullptr;
+
+	if (bufferSize == 0)
+	{
+		fprintf(stderr, "BufferPool is not configured\n");
+		return nullptr;
+	}
+
+	if (flags & BUFFER_POOL_LARGE_PAGES)
+	{
+		SIZE_T largePageSize = GetLargePageMinimum();
+
+		if (largePageSize > 0 && enableLockMemoryPrivilege())
+		{
+			SIZE_T largeSize = ((SIZE_T)bufferSize + largePageSize - 1) & ~(largePageSize - 1);
+
+			memory = VirtualAlloc(NULL, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (memory != nullptr)
+			{
+				size = largeSize;
+				largePages = true;
+			}
+		}
+
+		if (memory == nullptr)
+		{
+			fprintf(stderr, "Large pages are not available, using regular pages (%d)\n", GetLastError());
+		}
+	}
+
+	if (memory == nullptr)
+	{
+		memory = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (memory == nullptr)
+		{
+			fprintf(stderr, "VirtualAlloc failed with %d\n", GetLastError());
+			return nullptr;
+		}
+	}
+
+	CaptureBuffer* buffer = new CaptureBuffer();
+	buffer->data = (unsigned char*)memory;
+	buffer->capacity = bufferSize;
+	buffer->length = 0;
+	buffer->allocationSize = size;
+	buffer->flags = flags;
+	buffer->largePages = largePages;
+	buffer->locked = false;
+
+	if (largePages == false)
+	{
+		// fault pages in now rather than on the first reads
+		for (SIZE_T offset = 0; offset < size; offset += pageSize)
+		{
+			buffer->data[offset] = 0;
+		}
+
+		// locked pages count against the minimum working set, which is small by default
+		if ((flags & BUFFER_POOL_LOCKED) && growWorkingSet(size))
+		{
+			if (VirtualLock(memory, size))
+			{
+				buffer->locked = true;
+			}
+			else
+			{
+				fprintf(stderr, "VirtualLock failed with %d\n", GetLastError());
+				shrinkWorkingSet(size);
+			}
+		}
+	}
+	else
+	{
+		// large pages are never paged out
+		buffer->locked = true;
+	}
+
+	buffers.push_back(buffer);
+
+	stats.allocated++;
+	stats.bytes += size;
+	stats.largePageBuffers += largePages ? 1 : 0;
+	stats.lockedBuffers += buffer->locked ? 1 : 0;
+
+	return buffer;
+}
+
+void BufferPool::destroy(CaptureBuffer* buffer)
+{
+	if (buffer->locked && buffer->largePages == false)
+	{
+		VirtualUnlock(buffer->data, buffer->allocationSize);
+		shrinkWorkingSet(buffer->allocationSize);
+	}
+
+	VirtualFree(buffer->data, 0, MEM_RELEASE);
+
+	buffers.erase(std::find(buffers.begin(), buffers.end(), buffer));
+
+	stats.allocated--;
+	stats.bytes -= buffer->allocationSize;
+	stats.largePageBuffers -= buffer->largePages ? 1 : 0;
+	stats.lockedBuffers -= buffer->locked ? 1 : 0;
+
+	delete buffer;
+}
+
+bool BufferPool::enableLockMemoryPrivilege()
+{
+	static std::once_flag once;
+	static bool enabled = false;
+
+	std::call_once(once, []()
+	{
+		HANDLE token;
+		TOKEN_PRIVILEGES privileges;
+
+		if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token) == FALSE)
+		{
+			return;
+		}
+
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+		if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+			AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+			GetLastError() == ERROR_SUCCESS)
+		{
+			enabled = true;
+		}
+
+		CloseHandle(token);
+	});
+
+	return enabled;
+}
+
+bool BufferPool::growWorkingSet(SIZE_T size)
+{
+	SIZE_T minimum;
+	SIZE_T maximum;
+
+	if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum) == FALSE ||
+		SetProcessWorkingSetSize(GetCurrentProcess(), minimum + size, maximum + size) == FALSE)
+	{
+		fprintf(stderr, "Couldn't grow the working set for locked buffers (%d)\n", GetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+void BufferPool::shrinkWorkingSet(SIZE_T size)
+{
+	SIZE_T minimum;
+	SIZE_T maximum;
+
+	if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum) && minimum > size && maximum > size)
+	{
+		SetProcessWorkingSetSize(GetCurrentProcess(), minimum - size, maximum - size);
+	}
+}
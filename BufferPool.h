@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <mutex>
+#include <vector>
+
+#define BUFFER_POOL_LARGE_PAGES (1 << 0) // use large pages when SeLockMemoryPrivilege is available
+#define BUFFER_POOL_LOCKED      (1 << 1) // lock buffers in the working set
+
+struct CaptureBuffer
+{
+	unsigned char* data; // page aligned
+	DWORD capacity;
+	DWORD length;        // valid bytes after a read
+	DWORD references;    // owners that still need the buffer, see retain()
+
+	SIZE_T allocationSize;
+	unsigned int flags;  // pool flags the buffer was allocated with
+	bool largePages;
+	bool locked;
+};
+
+struct BufferPoolStats
+{
+	size_t allocated; // buffers owned by the pool
+	size_t inUse;
+	size_t peakInUse;
+
+	UINT64 acquired;  // acquire() calls
+	UINT64 reused;    // acquire() calls served without allocating
+
+	SIZE_T bytes;     // memory committed for all buffers
+	size_t largePageBuffers;
+	size_t lockedBuffers;
+};
+
+// Page-aligned read buffers allocated with VirtualAlloc once and recycled
+// across reads and capture restarts. Pages are touched on allocation so the
+// first reads do not fault them in. The pool owns every buffer it allocated,
+// destroying it frees buffers that were never released as well.
+class BufferPool
+{
+public:
+	BufferPool() = default;
+	BufferPool(DWORD bufferSize, unsigned int flags = 0);
+	~BufferPool();
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+public:
+	bool configure(DWORD bufferSize, unsigned int flags = 0);
+	bool reserve(size_t count);
+
+	CaptureBuffer* acquire();
+	// Adds an owner, the buffer is recycled once every owner released it.
+	void retain(CaptureBuffer* buffer);
+	void release(CaptureBuffer* buffer);
+
+	DWORD getBufferSize();
+	BufferPoolStats getStats();
+
+private:
+	CaptureBuffer* allocate();
+	void destroy(CaptureBuffer* buffer);
+
+	static bool enableLockMemoryPrivilege();
+	static bool growWorkingSet(SIZE_T size);
+	static void shrinkWorkingSet(SIZE_T size);
+
+private:
+	std::mutex lock;
+
+	DWORD bufferSize = 0;
+	unsigned int flags = 0;
+
+	std::vector<CaptureBuffer*> buffers; // all allocated
+	std::vector<CaptureBuffer*> freeBuffers;
+	BufferPoolStats stats = {};
+
+};
@@ -0,0 +1,92 @@
+#include "CaptureOutput.h"
+
+#include <errno.h>
+
+#define FILE_OUTPUT_BUFFER_SIZE (1024*1024)
+
+FileOutput::~FileOutput()
+{
+	close();
+}
+
+bool FileOutput::open(const std::string& path)
+{
+	close();
+
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Couldn't create file %s\n", path.c_str());
+		return false;
+	}
+
+	setvbuf(file, NULL, _IOFBF, FILE_OUTPUT_BUFFER_SIZE);
+	return true;
+}
+
+bool FileOutput::write(const void* data, size_t length)
+{
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	if (fwrite(data, 1, length, file) != length)
+	{
+		fprintf(stderr, "Couldn't write file - %d\n", errno);
+		return false;
+	}
+
+	return true;
+}
+
+bool FileOutput::close()
+{
+	if (file == nullptr)
+	{
+		return true;
+	}
+
+	bool closed = (fclose(file) == 0);
+	file = nullptr;
+
+	return closed;
+}
+
+FileInput::~FileInput()
+{
+	close();
+}
+
+bool FileInput::open(const std::string& path)
+{
+	close();
+
+	file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Couldn't open file %s\n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool FileInput::seek(UINT64 offset)
+{
+	return file != nullptr && _fseeki64(file, offset, SEEK_SET) == 0;
+}
+
+bool FileInput::read(void* data, size_t length)
+{
+	return file != nullptr && fread(data, 1, length, file) == length;
+}
+
+void FileInput::close()
+{
+	if (file != nullptr)
+	{
+		fclose(file);
+		file = nullptr;
+	}
+}
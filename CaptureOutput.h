@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include <string>
+
+// Byte stream a capture file is written to.
+class CaptureOutput
+{
+public:
+	virtual ~CaptureOutput() = default;
+
+public:
+	virtual bool write(const void* data, size_t length) = 0;
+	virtual bool close() = 0;
+};
+
+// Byte stream a capture file is read from, positions are uncompressed offsets.
+class CaptureInput
+{
+public:
+	virtual ~CaptureInput() = default;
+
+public:
+	virtual bool seek(UINT64 offset) = 0;
+	virtual bool read(void* data, size_t length) = 0;
+	virtual void close() = 0;
+};
+
+class FileOutput : public CaptureOutput
+{
+public:
+	FileOutput() = default;
+	~FileOutput();
+
+	FileOutput(const FileOutput&) = delete;
+	FileOutput& operator=(const FileOutput&) = delete;
+
+public:
+	bool open(const std::string& path);
+
+	bool write(const void* data, size_t length) override;
+	bool close() override;
+
+private:
+	FILE* file = nullptr;
+
+};
+
+class FileInput : public CaptureInput
+{
+public:
+	FileInput() = default;
+	~FileInput();
+
+	FileInput(const FileInput&) = delete;
+	FileInput& operator=(const FileInput&) = delete;
+
+public:
+	bool open(const std::string& path);
+
+	bool seek(UINT64 offset) override;
+	bool read(void* data, size_t length) override;
+	void close() override;
+
+private:
+	FILE* file = nullptr;
+
+};
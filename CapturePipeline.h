@@ -0,0 +1,180 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <utility>
+
+#include "CaptureRecord.h"
+
+// Compile-time capture pipeline: source -> decoder -> filter -> sink.
+// Policies are plain classes, so the whole chain is inlined into the
+// decode loop and constant filters fold away.
+//
+//   Source:  bool read(const unsigned char*& buffer, DWORD& bytes)
+//   Decoder: void decode(const unsigned char* buffer, DWORD bytes, Callback&& callback)
+//   Filter:  bool accept(const CaptureRecord& record) const
+//   Sink:    void deliver(const unsigned char* buffer, const CaptureRecord& record)
+
+struct RecordDecoder
+{
+	template <class Callback>
+	void decode(const unsigned char* buffer, DWORD bytes, Callback&& callback) const
+	{
+		decodeRecords(buffer, bytes, clock->now(), std::forward<Callback>(callback));
+	}
+
+	Clock* clock = &MonotonicClock::instance();
+};
+
+struct AcceptAll
+{
+	bool accept(const CaptureRecord&) const
+	{
+		return true;
+	}
+};
+
+// Filter used by USBPcapHelper::processInterruptData()
+struct BulkOrInterruptFilter
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return record.header.function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER &&
+			record.payloadLength != 0;
+	}
+};
+
+template <UCHAR Transfer>
+struct TransferFilter
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return record.header.transfer == Transfer;
+	}
+};
+
+template <USHORT Device>
+struct DeviceFilter
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return record.header.device == Device;
+	}
+};
+
+template <UCHAR Endpoint>
+struct EndpointFilter
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return record.header.endpoint == Endpoint;
+	}
+};
+
+template <DWORD MinLength>
+struct MinLengthFilter
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return record.payloadLength >= MinLength;
+	}
+};
+
+template <class First, class... Rest>
+struct AllOf
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return first.accept(record) && rest.accept(record);
+	}
+
+	First first;
+	AllOf<Rest...> rest;
+};
+
+template <class Last>
+struct AllOf<Last>
+{
+	bool accept(const CaptureRecord& record) const
+	{
+		return last.accept(record);
+	}
+
+	Last last;
+};
+
+template <class Filter, class Sink, class Decoder = RecordDecoder>
+class CapturePipeline
+{
+public:
+	CapturePipeline(Filter filter = Filter(), Sink sink = Sink(), Decoder decoder = Decoder())
+		: filter(std::move(filter)), sink(std::move(sink)), decoder(std::move(decoder))
+	{
+	}
+
+public:
+	// Returns number of records delivered to the sink.
+	size_t process(const unsigned char* buffer, DWORD bytes)
+	{
+		size_t delivered = 0;
+
+		decoder.decode(buffer, bytes, [this, buffer, &delivered](const CaptureRecord& record)
+		{
+			if (filter.accept(record))
+			{
+				sink.deliver(buffer, record);
+				delivered++;
+			}
+		});
+
+		return delivered;
+	}
+
+	// Same as above for records already decoded by USBPcapHelper.
+	size_t process(const RecordBatch& batch)
+	{
+		size_t delivered = 0;
+
+		for (size_t i = 0; i < batch.count; i++)
+		{
+			if (filter.accept(batch.records[i]))
+			{
+				sink.deliver(batch.buffer, batch.records[i]);
+				delivered++;
+			}
+		}
+
+		return delivered;
+	}
+
+	template <class Source>
+	size_t run(Source& source)
+	{
+		const unsigned char* buffer;
+		DWORD bytes;
+		size_t delivered = 0;
+
+		while (source.read(buffer, bytes))
+		{
+			delivered += process(buffer, bytes);
+		}
+
+		return delivered;
+	}
+
+	Filter& getFilter()
+	{
+		return filter;
+	}
+
+	Sink& getSink()
+	{
+		return sink;
+	}
+
+private:
+	Filter filter;
+	Sink sink;
+	Decoder decoder;
+
+};
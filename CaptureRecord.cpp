@@ -0,0 +1,13 @@
+#include "CaptureRecord.h"
+
+size_t parseRecords(const unsigned char* buffer, DWORD bytes, DWORD offset, UINT64 arrival, std::vector<CaptureRecord>& records)
+{
+	records.clear();
+
+	decodeRecordsAt(buffer, bytes, offset, arrival, [&records](const CaptureRecord& record)
+	{
+		records.push_back(record);
+	});
+
+	return records.size();
+}
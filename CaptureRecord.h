@@ -0,0 +1,141 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#include "Timestamp.h"
+#include "USBPcap.h"
+
+#define PCAP_MAGIC_NUMBER            0xA1B2C3D4
+#define PCAP_MAGIC_NUMBER_NS         0xA1B23C4D // nanosecond timestamps
+#define PCAP_MAGIC_NUMBER_SWAPPED    0xD4C3B2A1 // other byte order
+#define PCAP_MAGIC_NUMBER_NS_SWAPPED 0x4D3CB2A1
+#define PCAP_VERSION_MAJOR           2
+
+// One pcap record found in a buffer read from \\.\USBPcapN.
+// Header fields are copied out so consumers never touch the packed layout.
+struct CaptureRecord
+{
+	pcaprec_hdr_t record;
+	USBPCAP_BUFFER_PACKET_HEADER header;
+
+	DWORD offset;        // pcap record header within the buffer
+	DWORD payloadOffset; // packet data following the USBPcap header
+	DWORD payloadLength; // captured packet data, at most header.dataLength
+
+	UINT64 timestamp;    // ns since Unix epoch, from record
+	UINT64 arrival;      // monotonic ns when the read buffer reached user space
+};
+
+struct RecordIndex;
+
+// All records of one read buffer.
+struct RecordBatch
+{
+	const unsigned char* buffer;
+	DWORD bytes;
+
+	const CaptureRecord* records;
+	size_t count;
+
+	UINT64 arrival;
+	const RecordIndex* index; // columnar copy of the records, nullptr unless enabled
+};
+
+// records begin at offset, past the file header of the first read
+size_t parseRecords(const unsigned char* buffer, DWORD bytes, DWORD offset, UINT64 arrival, std::vector<CaptureRecord>& records);
+
+// The first read after opening the device begins with the pcap file header,
+// offset is set past it. False when the header announces records in another
+// format than microsecond, little endian pcap 2.x of DLT_USBPCAP.
+inline bool skipPcapHeader(const unsigned char* buffer, DWORD bytes, DWORD& offset)
+{
+	offset = 0;
+
+	if (bytes < sizeof(pcap_hdr_t))
+	{
+		return true;
+	}
+
+	const pcap_hdr_t* header = (const pcap_hdr_t*)buffer;
+
+	switch (header->magic_number)
+	{
+	case PCAP_MAGIC_NUMBER:
+		offset = sizeof(pcap_hdr_t);
+		return header->version_major == PCAP_VERSION_MAJOR && header->network == DLT_USBPCAP;
+
+	case PCAP_MAGIC_NUMBER_NS:
+	case PCAP_MAGIC_NUMBER_SWAPPED:
+	case PCAP_MAGIC_NUMBER_NS_SWAPPED:
+		offset = sizeof(pcap_hdr_t);
+		return false;
+
+	default:
+		return true;
+	}
+}
+
+// Calls callback(const CaptureRecord&) for every USBPcap record from offset on.
+// Inline so that templated consumers get the whole loop in one function.
+template <class Callback>
+inline void decodeRecordsAt(const unsigned char* buffer, DWORD bytes, DWORD offset, UINT64 arrival, Callback&& callback)
+{
+	while (bytes - offset >= sizeof(pcaprec_hdr_t))
+	{
+		CaptureRecord entry;
+		memcpy(&entry.record, &buffer[offset], sizeof(pcaprec_hdr_t));
+
+		DWORD packetOffset = offset + sizeof(pcaprec_hdr_t);
+		if (entry.record.incl_len > bytes - packetOffset)
+		{
+			// driver only hands out whole records, anything else is corrupted
+			break;
+		}
+
+		entry.offset = offset;
+		entry.timestamp = pcapTimestampToNs(entry.record.ts_sec, entry.record.ts_usec);
+		entry.arrival = arrival;
+		offset = packetOffset + entry.record.incl_len;
+
+		if (entry.record.incl_len < sizeof(USBPCAP_BUFFER_PACKET_HEADER))
+		{
+			continue;
+		}
+
+		memcpy(&entry.header, &buffer[packetOffset], sizeof(USBPCAP_BUFFER_PACKET_HEADER));
+
+		if (entry.header.headerLen < sizeof(USBPCAP_BUFFER_PACKET_HEADER) ||
+			entry.header.headerLen > entry.record.incl_len)
+		{
+			continue;
+		}
+
+		entry.payloadOffset = packetOffset + entry.header.headerLen;
+		entry.payloadLength = entry.record.incl_len - entry.header.headerLen;
+
+		if (entry.payloadLength > entry.header.dataLength)
+		{
+			entry.payloadLength = entry.header.dataLength;
+		}
+
+		callback(entry);
+	}
+}
+
+// As decodeRecordsAt() for a buffer that may begin with the file header.
+template <class Callback>
+inline void decodeRecords(const unsigned char* buffer, DWORD bytes, UINT64 arrival, Callback&& callback)
+{
+	DWORD offset;
+
+	if (skipPcapHeader(buffer, bytes, offset) == false)
+	{
+		return;
+	}
+
+	decodeRecordsAt(buffer, bytes, offset, arrival, std::forward<Callback>(callback));
+}
@@ -0,0 +1,729 @@
+#include "CaptureSession.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "DescriptorCache.h"
+#include "DeviceIdentityMap.h"
+#include "FilterRegistry.h"
+#include "iocontrol.h"
+
+static std::mutex sessionsLock;
+static std::map<std::string, std::weak_ptr<CaptureSession>> sessions;
+
+std::shared_ptr<CaptureSession> CaptureSession::get(const std::string& filter)
+{
+	std::lock_guard<std::mutex> guard(sessionsLock);
+
+	std::shared_ptr<CaptureSession> session = sessions[filter].lock();
+
+	if (session == nullptr)
+	{
+		session.reset(new CaptureSession(filter));
+		sessions[filter] = session;
+	}
+
+	return session;
+}
+
+CaptureSession::CaptureSession(const std::string& filter)
+	: filter(filter)
+{
+	stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+CaptureSession::~CaptureSession()
+{
+	stop();
+
+	if (readerThread.joinable())
+	{
+		// the reader holds a reference until it returned, it may have dropped the last one
+		if (readerThread.get_id() == std::this_thread::get_id())
+		{
+			readerThread.detach();
+		}
+		else
+		{
+			readerThread.join();
+		}
+	}
+
+	if (stopEvent != NULL)
+	{
+		CloseHandle(stopEvent);
+	}
+
+	if (wakeEvent != NULL)
+	{
+		CloseHandle(wakeEvent);
+	}
+
+	std::lock_guard<std::mutex> guard(sessionsLock);
+
+	auto it = sessions.find(filter);
+	if (it != sessions.end() && it->second.expired())
+	{
+		sessions.erase(it);
+	}
+}
+
+bool CaptureSession::subscribe(CaptureSubscriber* subscriber, const DeviceAddressSet& addresses, const CaptureSessionOptions& options)
+{
+	std::lock_guard<std::mutex> state(stateLock);
+
+	{
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
+		auto it = std::find_if(subscriptions.begin(), subscriptions.end(),
+			[subscriber](const std::unique_ptr<Subscription>& subscription) { return subscription->subscriber == subscriber; });
+
+		if (it == subscriptions.end())
+		{
+			std::unique_ptr<Subscription> subscription(new Subscription());
+			subscription->subscriber = subscriber;
+
+			subscriptions.push_back(std::move(subscription));
+			it = subscriptions.end() - 1;
+		}
+
+		(*it)->addresses = addresses;
+
+		if (running)
+		{
+			// the map of this bus is only written by the reader
+			if (options.identities && identities == false)
+			{
+				seedIdentities = true;
+				wake();
+			}
+
+			return applyFilter();
+		}
+	}
+
+	this->options = options;
+
+	if (start() == false)
+	{
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
+		subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+			[subscriber](const std::unique_ptr<Subscription>& subscription) { return subscription->subscriber == subscriber; }), subscriptions.end());
+		return false;
+	}
+
+	return true;
+}
+
+void CaptureSession::unsubscribe(CaptureSubscriber* subscriber)
+{
+	std::unique_lock<std::mutex> state(stateLock, std::defer_lock);
+
+	// a subscriber stopping from its own callback already runs on the reader thread
+	if (onReaderThread() == false)
+	{
+		state.lock();
+	}
+
+	bool last;
+
+	{
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
+		for (size_t i = 0; i < subscriptions.size(); i++)
+		{
+			if (subscriptions[i]->subscriber != subscriber)
+			{
+				continue;
+			}
+
+			if (dispatching)
+			{
+				// forEachSubscriber() skips and removes it afterwards
+				subscriptions[i]->subscriber = nullptr;
+			}
+			else
+			{
+				subscriptions.erase(subscriptions.begin() + i);
+			}
+
+			break;
+		}
+
+		last = std::none_of(subscriptions.begin(), subscriptions.end(),
+			[](const std::unique_ptr<Subscription>& subscription) { return subscription->subscriber != nullptr; });
+
+		if (last == false && running)
+		{
+			applyFilter();
+		}
+	}
+
+	if (last)
+	{
+		stop();
+	}
+}
+
+bool CaptureSession::setAddresses(CaptureSubscriber* subscriber, const DeviceAddressSet& addresses)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	Subscription* subscription = findSubscription(subscriber);
+	if (subscription == nullptr)
+	{
+		return false;
+	}
+
+	// records already read are dispatched with the new addresses
+	subscription->addresses = addresses;
+
+	return applyFilter();
+}
+
+bool CaptureSession::addAddress(CaptureSubscriber* subscriber, int address)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	Subscription* subscription = findSubscription(subscriber);
+	if (subscription == nullptr || subscription->addresses.add(address) == false)
+	{
+		return false;
+	}
+
+	return applyFilter();
+}
+
+bool CaptureSession::removeAddress(CaptureSubscriber* subscriber, int address)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	Subscription* subscription = findSubscription(subscriber);
+	if (subscription == nullptr || subscription->addresses.remove(address) == false)
+	{
+		return false;
+	}
+
+	return applyFilter();
+}
+
+bool CaptureSession::getAddresses(CaptureSubscriber* subscriber, DeviceAddressSet& addresses)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	Subscription* subscription = findSubscription(subscriber);
+	if (subscription == nullptr)
+	{
+		return false;
+	}
+
+	addresses = subscription->addresses;
+	return true;
+}
+
+bool CaptureSession::isRunning()
+{
+	return running;
+}
+
+void CaptureSession::wake()
+{
+	SetEvent(wakeEvent);
+}
+
+const std::string& CaptureSession::getFilter() const
+{
+	return filter;
+}
+
+BufferPool& CaptureSession::getBufferPool()
+{
+	return bufferPool;
+}
+
+DWORD CaptureSession::getBufferSize()
+{
+	return options.bufferlen;
+}
+
+bool CaptureSession::start()
+{
+	if (stopEvent == NULL || wakeEvent == NULL)
+	{
+		printf("CreateEvent failed\n");
+		return false;
+	}
+
+	// reader may have ended on its own or been stopped from one of its callbacks,
+	// it closes the device handle before it returns
+	if (readerThread.joinable())
+	{
+		if (onReaderThread())
+		{
+			printf("Capture can't be restarted from its own reader thread\n");
+			return false;
+		}
+
+		joinReader();
+	}
+
+	ResetEvent(stopEvent);
+
+	// devices connected before the capture never show their descriptors
+	identities = options.identities;
+	seedIdentities = false;
+
+	if (identities && DeviceIdentityMap::instance().seed(filter) == false)
+	{
+		printf("Couldn't read descriptors of the connected devices\n");
+	}
+
+	// buffers stay allocated across restarts, only the first start pays for them
+	if (bufferPool.configure(options.bufferlen, options.bufferFlags) == false || bufferPool.reserve(1) == false)
+	{
+		printf("Couldn't allocate read buffer\n");
+		return false;
+	}
+
+	deviceHandle = CreateFileA(filter.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, 0);
+	if (deviceHandle == INVALID_HANDLE_VALUE)
+	{
+		printf("Couldn't open device: %d\n", GetLastError());
+		return false;
+	}
+
+
+	if (control(IOCTL_USBPCAP_SET_SNAPLEN_SIZE, &options.snaplen, sizeof(options.snaplen)) == false ||
+		control(IOCTL_USBPCAP_SETUP_BUFFER, &options.bufferlen, sizeof(options.bufferlen)) == false)
+	{
+		goto FINISH;
+	}
+
+	{
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
+		programmed = combineAddresses();
+		attached.clear();
+		requests.clear();
+
+		if (control(IOCTL_USBPCAP_START_FILTERING, &programmed.getFilter(), sizeof(USBPCAP_ADDRESS_FILTER)) == false)
+		{
+			goto FINISH;
+		}
+	}
+
+	running = true;
+
+	{
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
+		// the last reference may be released while the reader is still in a callback
+		std::shared_ptr<CaptureSession> self = shared_from_this();
+
+		readerThread = std::thread([self]() { self->readDataFromDevice(); });
+		readerId = readerThread.get_id();
+	}
+
+	return true;
+
+FINISH:
+	closeDevice();
+
+	return false;
+}
+
+void CaptureSession::stop()
+{
+	running = false;
+
+	if (stopEvent != NULL)
+	{
+		SetEvent(stopEvent);
+	}
+
+	// last subscriber may leave from a callback on the reader thread itself, the
+	// reader then cleans up once the callback returns and start() joins it
+	if (readerThread.joinable() && onReaderThread() == false)
+	{
+		joinReader();
+	}
+}
+
+bool CaptureSession::onReaderThread()
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	return readerId == std::this_thread::get_id();
+}
+
+void CaptureSession::joinReader()
+{
+	readerThread.join();
+
+	// the id may be handed to another thread now
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	readerId = std::thread::id();
+}
+
+CaptureSession::Subscription* CaptureSession::findSubscription(CaptureSubscriber* subscriber)
+{
+	for (auto& subscription : subscriptions)
+	{
+		if (subscription->subscriber == subscriber)
+		{
+			return subscription.get();
+		}
+	}
+
+	return nullptr;
+}
+
+DeviceAddressSet CaptureSession::combineAddresses()
+{
+	DeviceAddressSet combined;
+
+	for (auto& subscription : subscriptions)
+	{
+		if (subscription->subscriber != nullptr)
+		{
+			combined |= subscription->addresses;
+		}
+	}
+
+	return combined;
+}
+
+bool CaptureSession::applyFilter()
+{
+	// not capturing, start() programs the union
+	if (running == false || deviceHandle == INVALID_HANDLE_VALUE)
+	{
+		return true;
+	}
+
+	DeviceAddressSet combined = combineAddresses();
+
+	if (combined == programmed)
+	{
+		return true;
+	}
+
+	// handle, buffers and the pending read stay as they are
+	if (control(IOCTL_USBPCAP_STOP_FILTERING, NULL, 0) == false ||
+		control(IOCTL_USBPCAP_START_FILTERING, &combined.getFilter(), sizeof(USBPCAP_ADDRESS_FILTER)) == false)
+	{
+		return false;
+	}
+
+	programmed = combined;
+	return true;
+}
+
+bool CaptureSession::control(DWORD code, const void* input, DWORD length)
+{
+	OVERLAPPED overlapped;
+	DWORD bytes_ret = 0;
+
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	// handle is opened for overlapped I/O, the reader may have a read pending
+	BOOL result = DeviceIoControl(deviceHandle, code, const_cast<void*>(input), length, NULL, 0, &bytes_ret, &overlapped);
+	if (result == FALSE && GetLastError() == ERROR_IO_PENDING)
+	{
+		result = GetOverlappedResult(deviceHandle, &overlapped, &bytes_ret, TRUE);
+	}
+
+	if (result == FALSE)
+	{
+		printf("DeviceIoControl failed with %d status (supplimentary code %d)\n", GetLastError(), bytes_ret);
+	}
+
+	CloseHandle(overlapped.hEvent);
+	return result != FALSE;
+}
+
+void CaptureSession::closeDevice()
+{
+	// setAddresses() may be reprogramming the filter from another thread
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	CloseHandle(deviceHandle);
+	deviceHandle = INVALID_HANDLE_VALUE;
+}
+
+template <class Function>
+void CaptureSession::forEachSubscriber(Function&& function)
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	bool outer = dispatching;
+	dispatching = true;
+
+	// subscribers may subscribe or unsubscribe from their callbacks
+	for (size_t i = 0; i < subscriptions.size(); i++)
+	{
+		if (subscriptions[i]->subscriber != nullptr)
+		{
+			function(*subscriptions[i]);
+		}
+	}
+
+	dispatching = outer;
+
+	if (dispatching == false)
+	{
+		subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+			[](const std::unique_ptr<Subscription>& subscription) { return subscription->subscriber == nullptr; }), subscriptions.end());
+	}
+}
+
+void CaptureSession::readDataFromDevice()
+{
+	OVERLAPPED readOverlapped;
+	HANDLE waitHandles[3];
+
+	HANDLE mmcssHandle = applyThreadOptions(options.reader);
+
+	CaptureBuffer* captureBuffer = bufferPool.acquire();
+	if (captureBuffer == nullptr)
+	{
+		fprintf(stderr, "No read buffer available in read_thread()\n");
+		closeDevice();
+		revertThreadOptions(mmcssHandle);
+		running = false;
+		return;
+	}
+
+	memset(&readOverlapped, 0, sizeof(readOverlapped));
+	readOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	waitHandles[0] = readOverlapped.hEvent;
+	waitHandles[1] = stopEvent;
+	waitHandles[2] = wakeEvent;
+
+	ReadFile(deviceHandle, captureBuffer->data, options.bufferlen, NULL, &readOverlapped);
+
+	// only the first read after opening the device carries the file header
+	bool firstRead = true;
+
+	while (running)
+	{
+		DWORD dw = WaitForMultipleObjects(3, waitHandles, FALSE, nextTimeout());
+		DWORD read;
+
+		if (dw == WAIT_OBJECT_0)
+		{
+			GetOverlappedResult(deviceHandle, &readOverlapped, &read, TRUE);
+			ResetEvent(readOverlapped.hEvent);
+
+			DWORD offset = 0;
+
+			if (firstRead)
+			{
+				firstRead = false;
+
+				// records of another format would be misread, subscribers see onStopped()
+				if (checkPcapHeader(captureBuffer->data, read, offset) == false)
+				{
+					break;
+				}
+			}
+
+			dispatch(captureBuffer, read, offset);
+
+			// subscribers may have kept the buffer, an unshared one comes straight back
+			bufferPool.release(captureBuffer);
+			captureBuffer = bufferPool.acquire();
+
+			if (captureBuffer == nullptr)
+			{
+				fprintf(stderr, "No read buffer available in read_thread()\n");
+				break;
+			}
+
+			ReadFile(deviceHandle, captureBuffer->data, options.bufferlen, &read, &readOverlapped);
+		}
+		else if (dw == WAIT_OBJECT_0 + 1)
+		{
+			break;
+		}
+		else if (dw == WAIT_OBJECT_0 + 2 || dw == WAIT_TIMEOUT)
+		{
+			// subscriber timers, handled below
+		}
+		else if (dw == WAIT_FAILED)
+		{
+			fprintf(stderr, "WaitForMultipleObjects failed in read_thread(): %d", GetLastError());
+			break;
+		}
+
+		if (seedIdentities.exchange(false))
+		{
+			identities = true;
+			DeviceIdentityMap::instance().seed(filter);
+		}
+
+		forEachSubscriber([](Subscription& subscription) { subscription.subscriber->onTimer(); });
+	}
+
+	DWORD cancelled;
+
+	// buffer goes back to the pool, wait until the driver is done with it
+	CancelIo(deviceHandle);
+	GetOverlappedResult(deviceHandle, &readOverlapped, &cancelled, TRUE);
+	CloseHandle(readOverlapped.hEvent);
+	closeDevice();
+
+	bufferPool.release(captureBuffer);
+
+	revertThreadOptions(mmcssHandle);
+
+	if (running.exchange(false))
+	{
+		// reads fail when the host controller went away, its devices with it
+		DescriptorCache::instance().invalidate(FilterRegistry::roothubNumber(filter));
+
+		forEachSubscriber([](Subscription& subscription) { subscription.subscriber->onStopped(); });
+	}
+}
+
+bool CaptureSession::checkPcapHeader(const unsigned char* buffer, DWORD bytes, DWORD& offset)
+{
+	if (skipPcapHeader(buffer, bytes, offset))
+	{
+		return true;
+	}
+
+	const pcap_hdr_t* header = (const pcap_hdr_t*)buffer;
+
+	fprintf(stderr, "Unsupported capture format: magic 0x%08X, version %u.%u, link type %u\n",
+		header->magic_number, header->version_major, header->version_minor, header->network);
+	return false;
+}
+
+void CaptureSession::dispatch(CaptureBuffer* buffer, DWORD bytes, DWORD offset)
+{
+	UINT64 arrival = options.clock->now();
+
+	if (parseRecords(buffer->data, bytes, offset, arrival, records) == 0)
+	{
+		return;
+	}
+
+	if (identities)
+	{
+		RecordBatch batch = {};
+		batch.buffer = buffer->data;
+		batch.bytes = bytes;
+		batch.records = records.data();
+		batch.count = records.size();
+		batch.arrival = arrival;
+
+		DeviceIdentityMap::instance().observe(batch);
+	}
+
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	// driver adds newly connected devices on its own when the address 0 bit is set,
+	// their records go to the subscribers asking for new devices
+	DeviceAddressSet claimed = programmed;
+	claimed.setAll(false);
+
+	trackAttached(buffer->data, claimed);
+
+	forEachSubscriber([this, buffer, bytes, arrival, &claimed](Subscription& subscription)
+	{
+		RecordBatch batch = {};
+		batch.buffer = buffer->data;
+		batch.bytes = bytes;
+		batch.arrival = arrival;
+		batch.index = nullptr;
+
+		if (subscription.addresses.isAll())
+		{
+			batch.records = records.data();
+			batch.count = records.size();
+		}
+		else
+		{
+			subscription.records.clear();
+
+			bool newDevices = subscription.addresses.contains(0);
+
+			for (auto& record : records)
+			{
+				USHORT device = record.header.device;
+
+				if (subscription.addresses.contains(device) || (newDevices && claimed.contains(device) == false && attached.contains(device)))
+				{
+					subscription.records.push_back(record);
+				}
+			}
+
+			if (subscription.records.empty())
+			{
+				return;
+			}
+
+			batch.records = subscription.records.data();
+			batch.count = subscription.records.size();
+		}
+
+		subscription.subscriber->onBatch(batch, buffer);
+	});
+}
+
+void CaptureSession::trackAttached(const unsigned char* buffer, const DeviceAddressSet& claimed)
+{
+	if (programmed.contains(0) == false)
+	{
+		attached.clear();
+		requests.clear();
+		return;
+	}
+
+	for (auto& record : records)
+	{
+		USHORT device = record.header.device;
+		ControlSetup setup;
+
+		bool enumerated = requests.observe(buffer, record, setup) && setup.isGetDeviceDescriptor();
+
+		if (claimed.contains(device) || attached.contains(device))
+		{
+			continue;
+		}
+
+		// Without filterAll the driver captures an unclaimed device only because of
+		// the address 0 bit. With it every device is captured, one connected later
+		// shows up with the device descriptor its drivers read at the new address.
+		if (programmed.isAll() == false || enumerated)
+		{
+			attached.add(device);
+		}
+	}
+}
+
+DWORD CaptureSession::nextTimeout()
+{
+	std::lock_guard<std::recursive_mutex> guard(lock);
+
+	DWORD timeout = INFINITE;
+
+	for (auto& subscription : subscriptions)
+	{
+		if (subscription->subscriber != nullptr)
+		{
+			timeout = std::min(timeout, subscription->subscriber->getTimeout());
+		}
+	}
+
+	return timeout;
+}
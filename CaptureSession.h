@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BufferPool.h"
+#include "CaptureRecord.h"
+#include "ControlRequests.h"
+#include "DeviceAddressSet.h"
+#include "ThreadOptions.h"
+#include "Timestamp.h"
+#include "USBPcap.h"
+
+#define DEFAULT_SNAPSHOT_LENGTH             (65535)
+#define DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE (1024*1024)
+
+struct CaptureSessionOptions
+{
+	unsigned int snaplen = DEFAULT_SNAPSHOT_LENGTH;
+	unsigned int bufferlen = DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE;
+	unsigned int bufferFlags = 0;
+
+	ThreadOptions reader;
+	Clock* clock = &MonotonicClock::instance();
+
+	// keep DeviceIdentityMap up to date for this root hub
+	bool identities = false;
+};
+
+// Receives the records of its subscribed addresses on the reader thread.
+class CaptureSubscriber
+{
+public:
+	virtual ~CaptureSubscriber() = default;
+
+public:
+	// buffer may be kept past the call with BufferPool::retain()
+	virtual void onBatch(const RecordBatch& batch, CaptureBuffer* buffer) = 0;
+
+	// Longest time the reader may wait for data, onTimer() is called after it.
+	virtual DWORD getTimeout()
+	{
+		return INFINITE;
+	}
+
+	virtual void onTimer()
+	{
+	}
+
+	// reader ended without being stopped
+	virtual void onStopped()
+	{
+	}
+};
+
+// One capture of a root hub shared by every subscriber on it: one driver
+// handle, one reader thread and one filter program, the union of all
+// subscribed addresses. Records are dispatched to the subscribers of their
+// device address. Sessions are reference counted through get(), capture
+// runs while there are subscribers. The reader thread holds a reference of
+// its own, a session released from one of its callbacks lives until the
+// reader returned.
+class CaptureSession : public std::enable_shared_from_this<CaptureSession>
+{
+public:
+	// filter is the \\.\USBPcapN control device of the root hub
+	static std::shared_ptr<CaptureSession> get(const std::string& filter);
+	~CaptureSession();
+
+	CaptureSession(const CaptureSession&) = delete;
+	CaptureSession& operator=(const CaptureSession&) = delete;
+
+public:
+	// The first subscriber starts the capture with its options, later ones share it.
+	bool subscribe(CaptureSubscriber* subscriber, const DeviceAddressSet& addresses, const CaptureSessionOptions& options);
+	void unsubscribe(CaptureSubscriber* subscriber);
+	// Reprograms the driver filter on the open handle, capture keeps running.
+	// Safe from subscriber callbacks.
+	bool setAddresses(CaptureSubscriber* subscriber, const DeviceAddressSet& addresses);
+	bool addAddress(CaptureSubscriber* subscriber, int address);
+	bool removeAddress(CaptureSubscriber* subscriber, int address);
+	bool getAddresses(CaptureSubscriber* subscriber, DeviceAddressSet& addresses);
+
+	bool isRunning();
+	// Makes the reader ask its subscribers for a new timeout.
+	void wake();
+
+	const std::string& getFilter() const;
+	BufferPool& getBufferPool();
+	DWORD getBufferSize();
+
+private:
+	explicit CaptureSession(const std::string& filter);
+
+	struct Subscription
+	{
+		CaptureSubscriber* subscriber; // nullptr once unsubscribed during dispatch
+		DeviceAddressSet addresses;
+		std::vector<CaptureRecord> records;
+	};
+
+	bool start();
+	void stop();
+	bool onReaderThread();
+	void joinReader();
+
+	Subscription* findSubscription(CaptureSubscriber* subscriber);
+	DeviceAddressSet combineAddresses();
+	bool applyFilter();
+	bool control(DWORD code, const void* input, DWORD length);
+	void closeDevice();
+
+	void readDataFromDevice();
+	bool checkPcapHeader(const unsigned char* buffer, DWORD bytes, DWORD& offset);
+	void dispatch(CaptureBuffer* buffer, DWORD bytes, DWORD offset);
+	void trackAttached(const unsigned char* buffer, const DeviceAddressSet& claimed);
+	template <class Function>
+	void forEachSubscriber(Function&& function);
+	DWORD nextTimeout();
+
+private:
+	std::string filter;
+	HANDLE deviceHandle = INVALID_HANDLE_VALUE;
+
+	std::mutex stateLock; // start and stop
+	std::atomic<bool> running{ false };
+	std::thread readerThread;
+	std::thread::id readerId; // under lock, readerThread itself only changes in start() and stop()
+	std::atomic<bool> seedIdentities{ false }; // requested by a later subscriber
+	std::atomic<bool> identities{ false };
+	HANDLE stopEvent = NULL; // lives as long as the session, reset by start()
+	HANDLE wakeEvent = NULL;
+
+	CaptureSessionOptions options;
+	BufferPool bufferPool;
+
+	std::recursive_mutex lock; // subscriptions and the filter program, held while dispatching
+	std::vector<std::unique_ptr<Subscription>> subscriptions;
+	DeviceAddressSet programmed;
+	DeviceAddressSet attached; // unclaimed devices the driver added for the address 0 bit
+	ControlRequests requests;
+	bool dispatching = false;
+
+	std::vector<CaptureRecord> records;
+
+};
@@ -0,0 +1,142 @@
+#include "ChangeDetector.h"
+
+#include <string.h>
+
+void ChangeDetector::enable(int device, int endpoint, UINT32 heartbeat)
+{
+	slots.forEach(device, endpoint, [&](Slot& slot, USHORT, UCHAR)
+	{
+		if (slot.enabled == false)
+		{
+			enabledSlots++;
+		}
+
+		slot.enabled = true;
+		slot.heartbeat = heartbeat;
+		slot.valid = false;
+		slot.repeats = 0;
+	});
+}
+
+void ChangeDetector::enable(USHORT device, const ConfigDescriptor& configuration, UINT32 heartbeat)
+{
+	for (UCHAR i = 0; i < configuration.getEndpointCount(); i++)
+	{
+		const EndpointInfo& endpoint = configuration.getEndpoint(i);
+
+		if (endpoint.transfer == USBPCAP_TRANSFER_INTERRUPT && (endpoint.address & 0x80))
+		{
+			enable(device, endpoint.address, heartbeat);
+		}
+	}
+}
+
+void ChangeDetector::disable(int device, int endpoint)
+{
+	slots.forEach(device, endpoint, [&](Slot& slot, USHORT, UCHAR)
+	{
+		if (slot.enabled)
+		{
+			enabledSlots--;
+		}
+
+		slot.enabled = false;
+		slot.valid = false;
+	});
+}
+
+bool ChangeDetector::isEnabled()
+{
+	return enabledSlots > 0;
+}
+
+void ChangeDetector::reset(int device)
+{
+	slots.forEach(device, -1, [&](Slot& slot, USHORT, UCHAR)
+	{
+		slot.valid = false;
+		slot.repeats = 0;
+	});
+}
+
+bool ChangeDetector::changed(const unsigned char* buffer, const CaptureRecord& record)
+{
+	if (enabledSlots == 0 ||
+		record.header.transfer != USBPCAP_TRANSFER_INTERRUPT || slots.isCovered(record.header.device) == false)
+	{
+		return true;
+	}
+
+	Slot& slot = slots.at(record.header.device, record.header.endpoint);
+
+	if (slot.enabled == false)
+	{
+		return true;
+	}
+
+	UINT64 hash = hashPayload(&buffer[record.payloadOffset], record.payloadLength);
+
+	if (slot.valid && slot.hash == hash && slot.length == record.payloadLength)
+	{
+		slot.repeats++;
+
+		if (slot.heartbeat == 0 || slot.repeats < slot.heartbeat)
+		{
+			slot.suppressed.fetch_add(1, std::memory_order_relaxed);
+			suppressed.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		heartbeats.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	slot.hash = hash;
+	slot.length = record.payloadLength;
+	slot.repeats = 0;
+	slot.valid = true;
+
+	delivered.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+ChangeDetectorStats ChangeDetector::getStats()
+{
+	ChangeDetectorStats stats;
+	stats.delivered = delivered.load(std::memory_order_relaxed);
+	stats.suppressed = suppressed.load(std::memory_order_relaxed);
+	stats.heartbeats = heartbeats.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+UINT64 ChangeDetector::getSuppressed(USHORT device, UCHAR endpoint)
+{
+	if (slots.isCovered(device) == false)
+	{
+		return 0;
+	}
+
+	return slots.at(device, endpoint).suppressed.load(std::memory_order_relaxed);
+}
+
+UINT64 ChangeDetector::hashPayload(const unsigned char* data, DWORD length)
+{
+	// FNV-1a over 8-byte words, reports are short so this stays in a few cycles
+	UINT64 hash = 0xCBF29CE484222325ull;
+	DWORD i = 0;
+
+	for (; i + 8 <= length; i += 8)
+	{
+		UINT64 word;
+		memcpy(&word, &data[i], sizeof(word));
+
+		hash = (hash ^ word) * 0x100000001B3ull;
+	}
+
+	for (; i < length; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001B3ull;
+	}
+
+	return hash;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <utility>
+
+#include "CaptureRecord.h"
+#include "ConfigDescriptor.h"
+#include "EndpointSlots.h"
+
+struct ChangeDetectorStats
+{
+	UINT64 delivered;  // records passed on, heartbeats included
+	UINT64 suppressed; // identical reports dropped
+	UINT64 heartbeats; // identical reports passed on because of the heartbeat
+};
+
+// Change-only delivery for interrupt endpoints. Keeps a 64-bit hash and the
+// length of the last payload per device/endpoint and drops reports equal to
+// it. With a heartbeat of N every Nth identical report is still delivered.
+//
+// enable()/disable() are not synchronized with changed(), configure before
+// start() or from the reader thread. Counters may be read at any time.
+class ChangeDetector
+{
+public:
+	ChangeDetector() = default;
+
+	ChangeDetector(const ChangeDetector&) = delete;
+	ChangeDetector& operator=(const ChangeDetector&) = delete;
+
+public:
+	// device/endpoint of -1 match all
+	void enable(int device = -1, int endpoint = -1, UINT32 heartbeat = 0);
+	// interrupt IN endpoints declared by the device's configuration
+	void enable(USHORT device, const ConfigDescriptor& configuration, UINT32 heartbeat = 0);
+	void disable(int device = -1, int endpoint = -1);
+	bool isEnabled();
+
+	// Forgets the last payloads, e.g. after a device was re-enumerated.
+	void reset(int device = -1);
+
+	// Returns false for a repeated interrupt payload that should be dropped.
+	bool changed(const unsigned char* buffer, const CaptureRecord& record);
+
+	ChangeDetectorStats getStats();
+	UINT64 getSuppressed(USHORT device, UCHAR endpoint);
+
+private:
+	struct Slot
+	{
+		UINT64 hash;
+		DWORD length;
+		UINT32 repeats;   // identical reports since the last delivery
+		UINT32 heartbeat;
+		bool enabled;
+		bool valid;
+
+		std::atomic<UINT64> suppressed;
+	};
+
+	static UINT64 hashPayload(const unsigned char* data, DWORD length);
+
+private:
+	EndpointSlotTable<Slot> slots;
+	size_t enabledSlots = 0;
+
+	std::atomic<UINT64> delivered{ 0 };
+	std::atomic<UINT64> suppressed{ 0 };
+	std::atomic<UINT64> heartbeats{ 0 };
+
+};
+
+// Sink adapter for CapturePipeline, forwards changed records only.
+template <class Sink>
+struct ChangeOnlySink
+{
+	void deliver(const unsigned char* buffer, const CaptureRecord& record)
+	{
+		if (detector->changed(buffer, record))
+		{
+			sink.deliver(buffer, record);
+		}
+	}
+
+	ChangeDetector* detector;
+	Sink sink;
+};
@@ -0,0 +1,345 @@
+#include "CompressedOutput.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "FastCodec.h"
+#include "Timestamp.h"
+
+double CompressionStats::ratio() const
+{
+	return (compressedBytes == 0) ? 0.0 : (double)rawBytes / compressedBytes;
+}
+
+double CompressionStats::megabytesPerSecond() const
+{
+	return (compressNs == 0) ? 0.0 : (rawBytes / (1024.0 * 1024.0)) / ((double)compressNs / NSEC_PER_SEC);
+}
+
+CompressedOutput::CompressedOutput(std::unique_ptr<CaptureOutput> output, DWORD blockSize)
+	: output(std::move(output)), blockSize(blockSize)
+{
+	current.reserve(blockSize);
+}
+
+CompressedOutput::~CompressedOutput()
+{
+	close();
+}
+
+bool CompressedOutput::start(const ThreadOptions& options)
+{
+	CompressedFileHeader header = {};
+	header.magic = COMPRESSED_FILE_MAGIC;
+	header.version = COMPRESSED_FILE_VERSION;
+	header.blockSize = blockSize;
+
+	if (output == nullptr || blockSize == 0 || output->write(&header, sizeof(header)) == false)
+	{
+		return false;
+	}
+
+	stats.compressedBytes = sizeof(header);
+
+	compressor = std::thread(&CompressedOutput::compressBlocks, this, options);
+	return true;
+}
+
+bool CompressedOutput::write(const void* data, size_t length)
+{
+	const UCHAR* bytes = (const UCHAR*)data;
+
+	while (length > 0)
+	{
+		size_t chunk = std::min(length, (size_t)blockSize - current.size());
+
+		current.insert(current.end(), bytes, bytes + chunk);
+		bytes += chunk;
+		length -= chunk;
+
+		if (current.size() == blockSize)
+		{
+			queueBlock();
+		}
+	}
+
+	return failed == false;
+}
+
+bool CompressedOutput::close()
+{
+	if (compressor.joinable() == false)
+	{
+		return output == nullptr || output->close();
+	}
+
+	if (current.empty() == false)
+	{
+		queueBlock();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closing = true;
+	}
+	queueChanged.notify_all();
+
+	compressor.join();
+
+	return output->close() && failed == false;
+}
+
+CompressionStats CompressedOutput::getStats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
+
+void CompressedOutput::queueBlock()
+{
+	std::vector<UCHAR> next;
+
+	{
+		std::unique_lock<std::mutex> guard(lock);
+
+		// back-pressure instead of unbounded memory when the disk is slower than capture
+		queueChanged.wait(guard, [this]() { return pending.size() < DEFAULT_COMPRESSION_QUEUE || failed; });
+
+		UINT64 offset = currentOffset;
+		currentOffset += current.size();
+
+		pending.emplace_back(offset, std::move(current));
+
+		if (spare.empty() == false)
+		{
+			next = std::move(spare.back());
+			spare.pop_back();
+		}
+	}
+	queueChanged.notify_all();
+
+	next.clear();
+	next.reserve(blockSize);
+	current = std::move(next);
+}
+
+void CompressedOutput::compressBlocks(ThreadOptions options)
+{
+	if (options.name.empty())
+	{
+		options.name = "USBPcap compressor";
+	}
+
+	HANDLE mmcssHandle = applyThreadOptions(options);
+	std::vector<UCHAR> compressed;
+	Clock& clock = MonotonicClock::instance();
+
+	while (true)
+	{
+		std::pair<UINT64, std::vector<UCHAR>> block;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+
+			queueChanged.wait(guard, [this]() { return pending.empty() == false || closing; });
+			if (pending.empty())
+			{
+				break;
+			}
+
+			block = std::move(pending.front());
+			pending.pop_front();
+		}
+		queueChanged.notify_all();
+
+		const std::vector<UCHAR>& raw = block.second;
+		compressed.resize(sizeof(CompressedFrameHeader) + fastCompressBound(raw.size()));
+
+		UINT64 begin = clock.now();
+		size_t size = fastCompress(raw.data(), raw.size(),
+			&compressed[sizeof(CompressedFrameHeader)], compressed.size() - sizeof(CompressedFrameHeader));
+		UINT64 elapsed = clock.now() - begin;
+
+		CompressedFrameHeader header;
+		header.rawOffset = block.first;
+		header.rawSize = (UINT32)raw.size();
+		header.storedSize = (UINT32)size;
+
+		if (size == 0 || size >= raw.size())
+		{
+			// random payloads do not compress, keep them as they are
+			memcpy(&compressed[sizeof(CompressedFrameHeader)], raw.data(), raw.size());
+			size = raw.size();
+			header.storedSize = (UINT32)size | COMPRESSED_FRAME_STORED;
+		}
+
+		memcpy(compressed.data(), &header, sizeof(header));
+
+		if (output->write(compressed.data(), sizeof(header) + size) == false)
+		{
+			failed = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			stats.rawBytes += raw.size();
+			stats.compressedBytes += sizeof(header) + size;
+			stats.frames++;
+			stats.compressNs += elapsed;
+
+			spare.push_back(std::move(block.second));
+		}
+		queueChanged.notify_all();
+	}
+
+	revertThreadOptions(mmcssHandle);
+}
+
+CompressedInput::~CompressedInput()
+{
+	close();
+}
+
+bool CompressedInput::isCompressed(const std::string& path)
+{
+	FileInput input;
+	UINT32 magic;
+
+	return input.open(path) && input.read(&magic, sizeof(magic)) && magic == COMPRESSED_FILE_MAGIC;
+}
+
+bool CompressedInput::open(const std::string& path)
+{
+	close();
+
+	if (file.open(path) == false)
+	{
+		return false;
+	}
+
+	CompressedFileHeader header;
+	if (file.read(&header, sizeof(header)) == false ||
+		header.magic != COMPRESSED_FILE_MAGIC || header.version != COMPRESSED_FILE_VERSION)
+	{
+		fprintf(stderr, "%s is not a compressed capture\n", path.c_str());
+		close();
+		return false;
+	}
+
+	// frame table is built from the headers only, payloads are skipped
+	UINT64 fileOffset = sizeof(header);
+	CompressedFrameHeader frameHeader;
+
+	while (file.read(&frameHeader, sizeof(frameHeader)))
+	{
+		Frame frame;
+		frame.rawOffset = frameHeader.rawOffset;
+		frame.rawSize = frameHeader.rawSize;
+		frame.storedSize = frameHeader.storedSize;
+		frame.fileOffset = fileOffset + sizeof(frameHeader);
+
+		frames.push_back(frame);
+
+		fileOffset = frame.fileOffset + (frame.storedSize & ~COMPRESSED_FRAME_STORED);
+		if (file.seek(fileOffset) == false)
+		{
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool CompressedInput::seek(UINT64 offset)
+{
+	position = offset;
+	return true;
+}
+
+bool CompressedInput::read(void* data, size_t length)
+{
+	UCHAR* out = (UCHAR*)data;
+
+	while (length > 0)
+	{
+		auto it = std::upper_bound(frames.begin(), frames.end(), position,
+			[](UINT64 offset, const Frame& frame) { return offset < frame.rawOffset; });
+
+		if (it == frames.begin())
+		{
+			return false;
+		}
+
+		size_t index = (it - frames.begin()) - 1;
+		const Frame& frame = frames[index];
+
+		if (position >= frame.rawOffset + frame.rawSize || loadFrame(index) == false)
+		{
+			return false;
+		}
+
+		size_t start = (size_t)(position - frame.rawOffset);
+		size_t chunk = std::min(length, (size_t)frame.rawSize - start);
+
+		memcpy(out, &cached[start], chunk);
+		out += chunk;
+		length -= chunk;
+		position += chunk;
+	}
+
+	return true;
+}
+
+void CompressedInput::close()
+{
+	file.close();
+	frames.clear();
+
+	cachedFrame = (size_t)-1;
+	position = 0;
+}
+
+bool CompressedInput::loadFrame(size_t index)
+{
+	if (cachedFrame == index)
+	{
+		return true;
+	}
+
+	const Frame& frame = frames[index];
+	UINT32 storedSize = frame.storedSize & ~COMPRESSED_FRAME_STORED;
+
+	cached.resize(frame.rawSize);
+	cachedFrame = (size_t)-1;
+
+	if (file.seek(frame.fileOffset) == false)
+	{
+		return false;
+	}
+
+	if (frame.storedSize & COMPRESSED_FRAME_STORED)
+	{
+		if (storedSize != frame.rawSize || file.read(cached.data(), storedSize) == false)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		stored.resize(storedSize);
+
+		if (file.read(stored.data(), storedSize) == false ||
+			fastDecompress(stored.data(), storedSize, cached.data(), frame.rawSize) == false)
+		{
+			fprintf(stderr, "Corrupted compressed frame at %llu\n", frame.fileOffset);
+			return false;
+		}
+	}
+
+	cachedFrame = index;
+	return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureOutput.h"
+#include "ThreadOptions.h"
+
+#define COMPRESSED_FILE_MAGIC   0x5A425355 // "USBZ"
+#define COMPRESSED_FILE_VERSION 1
+#define COMPRESSED_FRAME_STORED 0x80000000 // storedSize flag: payload is not compressed
+
+#define DEFAULT_COMPRESSION_BLOCK_SIZE (1024*1024)
+#define DEFAULT_COMPRESSION_QUEUE      8
+
+#pragma pack(push, 1)
+struct CompressedFileHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 blockSize; // uncompressed bytes per frame, last frame may hold less
+	UINT32 reserved;
+};
+
+struct CompressedFrameHeader
+{
+	UINT64 rawOffset; // uncompressed stream offset of the frame
+	UINT32 rawSize;
+	UINT32 storedSize; // payload bytes following the header, may have COMPRESSED_FRAME_STORED set
+};
+#pragma pack(pop)
+
+struct CompressionStats
+{
+	UINT64 rawBytes;
+	UINT64 compressedBytes; // including frame headers
+	UINT64 frames;
+	UINT64 compressNs;      // time spent in the codec
+
+	double ratio() const;
+	double megabytesPerSecond() const;
+};
+
+// Splits the byte stream into fixed-size blocks and compresses them with
+// the bundled codec on its own thread. Every frame records its uncompressed
+// offset, so files remain seekable and sidecar index offsets stay valid.
+class CompressedOutput : public CaptureOutput
+{
+public:
+	CompressedOutput(std::unique_ptr<CaptureOutput> output, DWORD blockSize = DEFAULT_COMPRESSION_BLOCK_SIZE);
+	~CompressedOutput();
+
+	CompressedOutput(const CompressedOutput&) = delete;
+	CompressedOutput& operator=(const CompressedOutput&) = delete;
+
+public:
+	bool start(const ThreadOptions& options = ThreadOptions());
+
+	bool write(const void* data, size_t length) override;
+	bool close() override;
+
+	CompressionStats getStats();
+
+private:
+	void queueBlock();
+	void compressBlocks(ThreadOptions options);
+
+private:
+	std::unique_ptr<CaptureOutput> output;
+	DWORD blockSize;
+
+	std::vector<UCHAR> current;
+	UINT64 currentOffset = 0;
+
+	std::mutex lock;
+	std::condition_variable queueChanged;
+	std::deque<std::pair<UINT64, std::vector<UCHAR>>> pending;
+	std::vector<std::vector<UCHAR>> spare;
+	bool closing = false;
+	std::atomic<bool> failed{ false };
+
+	std::thread compressor;
+	CompressionStats stats = {};
+
+};
+
+// Random access reader of files written by CompressedOutput.
+class CompressedInput : public CaptureInput
+{
+public:
+	CompressedInput() = default;
+	~CompressedInput();
+
+public:
+	static bool isCompressed(const std::string& path);
+
+	bool open(const std::string& path);
+
+	bool seek(UINT64 offset) override;
+	bool read(void* data, size_t length) override;
+	void close() override;
+
+private:
+	struct Frame
+	{
+		UINT64 rawOffset;
+		UINT32 rawSize;
+		UINT32 storedSize;
+		UINT64 fileOffset; // payload position in the compressed file
+	};
+
+	bool loadFrame(size_t index);
+
+private:
+	FileInput file;
+	std::vector<Frame> frames;
+
+	size_t cachedFrame = (size_t)-1;
+	std::vector<UCHAR> cached;
+	std::vector<UCHAR> stored;
+
+	UINT64 position = 0;
+
+};
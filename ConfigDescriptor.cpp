@@ -0,0 +1,200 @@
+#include "ConfigDescriptor.h"
+
+#include <string.h>
+
+#include "USBPcap.h"
+
+// bmAttributes bits 0-1 to USBPcap transfer type
+static const UCHAR transferTypes[4] =
+{
+	USBPCAP_TRANSFER_CONTROL,
+	USBPCAP_TRANSFER_ISOCHRONOUS,
+	USBPCAP_TRANSFER_BULK,
+	USBPCAP_TRANSFER_INTERRUPT
+};
+
+ConfigDescriptor::ConfigDescriptor()
+{
+	clear();
+}
+
+bool ConfigDescriptor::parse(const UCHAR* descriptor, size_t length)
+{
+	clear();
+
+	if (descriptor == nullptr || length < sizeof(USB_CONFIGURATION_DESCRIPTOR) ||
+		descriptor[1] != USB_CONFIGURATION_DESCRIPTOR_TYPE)
+	{
+		return false;
+	}
+
+	auto config = reinterpret_cast<const USB_CONFIGURATION_DESCRIPTOR*>(descriptor);
+	configurationValue = config->bConfigurationValue;
+
+	if (config->wTotalLength < length)
+	{
+		length = config->wTotalLength;
+	}
+
+	InterfaceInfo* current = nullptr;
+	size_t offset = 0;
+
+	while (offset + 2 <= length)
+	{
+		UCHAR bLength = descriptor[offset];
+		UCHAR bDescriptorType = descriptor[offset + 1];
+
+		if (bLength < 2 || offset + bLength > length)
+		{
+			// malformed chain, keep what was parsed so far
+			truncated = true;
+			break;
+		}
+
+		if (bDescriptorType == USB_INTERFACE_DESCRIPTOR_TYPE && bLength >= sizeof(USB_INTERFACE_DESCRIPTOR))
+		{
+			if (interfaceCount == CONFIG_MAX_INTERFACES)
+			{
+				truncated = true;
+				break;
+			}
+
+			auto desc = reinterpret_cast<const USB_INTERFACE_DESCRIPTOR*>(&descriptor[offset]);
+
+			current = &interfaces[interfaceCount++];
+			current->number = desc->bInterfaceNumber;
+			current->alternateSetting = desc->bAlternateSetting;
+			current->interfaceClass = desc->bInterfaceClass;
+			current->interfaceSubClass = desc->bInterfaceSubClass;
+			current->interfaceProtocol = desc->bInterfaceProtocol;
+			current->firstEndpoint = endpointCount;
+			current->numEndpoints = 0;
+		}
+		else if (bDescriptorType == USB_ENDPOINT_DESCRIPTOR_TYPE && bLength >= sizeof(USB_ENDPOINT_DESCRIPTOR) &&
+			current != nullptr)
+		{
+			if (endpointCount == CONFIG_MAX_ENDPOINTS)
+			{
+				truncated = true;
+				break;
+			}
+
+			auto desc = reinterpret_cast<const USB_ENDPOINT_DESCRIPTOR*>(&descriptor[offset]);
+			USHORT packetSize = desc->wMaxPacketSize & 0x07FF;
+			USHORT transactions = 1;
+
+			EndpointInfo& endpoint = endpoints[endpointCount];
+			endpoint.address = desc->bEndpointAddress;
+			endpoint.transfer = transferTypes[desc->bmAttributes & 0x03];
+
+			// bits 11-12 are reserved for control and bulk endpoints
+			if (endpoint.transfer == USBPCAP_TRANSFER_ISOCHRONOUS || endpoint.transfer == USBPCAP_TRANSFER_INTERRUPT)
+			{
+				transactions += (desc->wMaxPacketSize >> 11) & 0x03;
+			}
+
+			endpoint.maxPacketSize = packetSize * transactions;
+			endpoint.interval = desc->bInterval;
+			endpoint.interfaceIndex = interfaceCount - 1;
+
+			UCHAR slot = endpointSlot(endpoint.address);
+			if (endpointIndex[slot] == CONFIG_NO_ENDPOINT)
+			{
+				endpointIndex[slot] = endpointCount;
+			}
+
+			current->numEndpoints++;
+			endpointCount++;
+		}
+
+		offset += bLength;
+	}
+
+	return true;
+}
+
+void ConfigDescriptor::clear()
+{
+	configurationValue = 0;
+	truncated = false;
+
+	interfaceCount = 0;
+	endpointCount = 0;
+
+	memset(endpointIndex, CONFIG_NO_ENDPOINT, sizeof(endpointIndex));
+}
+
+UCHAR ConfigDescriptor::getConfigurationValue() const
+{
+	return configurationValue;
+}
+
+bool ConfigDescriptor::isTruncated() const
+{
+	return truncated;
+}
+
+UCHAR ConfigDescriptor::getInterfaceCount() const
+{
+	return interfaceCount;
+}
+
+const InterfaceInfo& ConfigDescriptor::getInterface(UCHAR index) const
+{
+	return interfaces[index];
+}
+
+UCHAR ConfigDescriptor::getEndpointCount() const
+{
+	return endpointCount;
+}
+
+const EndpointInfo& ConfigDescriptor::getEndpoint(UCHAR index) const
+{
+	return endpoints[index];
+}
+
+const EndpointInfo* ConfigDescriptor::findEndpoint(UCHAR address) const
+{
+	UCHAR index = endpointIndex[endpointSlot(address)];
+
+	return (index == CONFIG_NO_ENDPOINT) ? nullptr : &endpoints[index];
+}
+
+const EndpointInfo* ConfigDescriptor::findEndpoint(UCHAR address, UCHAR interfaceNumber, UCHAR alternateSetting) const
+{
+	for (UCHAR i = 0; i < interfaceCount; i++)
+	{
+		const InterfaceInfo& info = interfaces[i];
+
+		if (info.number != interfaceNumber || info.alternateSetting != alternateSetting)
+		{
+			continue;
+		}
+
+		for (UCHAR j = info.firstEndpoint; j < info.firstEndpoint + info.numEndpoints; j++)
+		{
+			if (endpoints[j].address == address)
+			{
+				return &endpoints[j];
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+USHORT ConfigDescriptor::getMaxPacketSize(UCHAR transfer) const
+{
+	USHORT maxPacketSize = 0;
+
+	for (UCHAR i = 0; i < endpointCount; i++)
+	{
+		if (endpoints[i].transfer == transfer && endpoints[i].maxPacketSize > maxPacketSize)
+		{
+			maxPacketSize = endpoints[i].maxPacketSize;
+		}
+	}
+
+	return maxPacketSize;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Windows.h>
+#include <Usbioctl.h>
+
+#include "EndpointSlots.h"
+
+#define CONFIG_MAX_INTERFACES 32 // interface alternate settings in one configuration
+#define CONFIG_MAX_ENDPOINTS  64 // endpoints of all alternate settings together
+
+#define CONFIG_NO_ENDPOINT 0xFF
+
+struct EndpointInfo
+{
+	UCHAR address;        // bEndpointAddress, bit 7 set for IN
+	UCHAR transfer;       // USBPCAP_TRANSFER_* to compare with USBPCAP_BUFFER_PACKET_HEADER
+	USHORT maxPacketSize; // bytes per (micro)frame, periodic endpoints include additional transactions
+	UCHAR interval;       // bInterval
+	UCHAR interfaceIndex; // index into interface table
+};
+
+struct InterfaceInfo
+{
+	UCHAR number;
+	UCHAR alternateSetting;
+	UCHAR interfaceClass;
+	UCHAR interfaceSubClass;
+	UCHAR interfaceProtocol;
+
+	UCHAR firstEndpoint; // index into endpoint table
+	UCHAR numEndpoints;
+};
+
+// Interface and endpoint tables of a configuration descriptor.
+// Parsing walks the descriptor chain in place and does not allocate.
+class ConfigDescriptor
+{
+public:
+	ConfigDescriptor();
+
+public:
+	bool parse(const UCHAR* descriptor, size_t length);
+	void clear();
+
+	UCHAR getConfigurationValue() const;
+	bool isTruncated() const;
+
+	UCHAR getInterfaceCount() const;
+	const InterfaceInfo& getInterface(UCHAR index) const;
+
+	UCHAR getEndpointCount() const;
+	const EndpointInfo& getEndpoint(UCHAR index) const;
+
+	// endpoint of the first alternate setting declaring the address
+	const EndpointInfo* findEndpoint(UCHAR address) const;
+	const EndpointInfo* findEndpoint(UCHAR address, UCHAR interfaceNumber, UCHAR alternateSetting) const;
+
+	USHORT getMaxPacketSize(UCHAR transfer) const;
+
+private:
+	UCHAR configurationValue;
+	bool truncated;
+
+	UCHAR interfaceCount;
+	UCHAR endpointCount;
+
+	InterfaceInfo interfaces[CONFIG_MAX_INTERFACES];
+	EndpointInfo endpoints[CONFIG_MAX_ENDPOINTS];
+
+	UCHAR endpointIndex[ENDPOINT_SLOTS];
+
+};
@@ -0,0 +1,89 @@
+#include "ControlRequests.h"
+
+#include <string.h>
+
+#include <Usbioctl.h>
+
+bool ControlSetup::isGetDeviceDescriptor() const
+{
+	return bmRequestType == 0x80 && bRequest == CONTROL_REQUEST_GET_DESCRIPTOR && (wValue >> 8) == USB_DEVICE_DESCRIPTOR_TYPE;
+}
+
+bool ControlSetup::isSetAddress() const
+{
+	return bmRequestType == 0x00 && bRequest == CONTROL_REQUEST_SET_ADDRESS;
+}
+
+ControlRequests::ControlRequests()
+{
+	clear();
+}
+
+bool ControlRequests::observe(const unsigned char* buffer, const CaptureRecord& record, ControlSetup& setup)
+{
+	UCHAR stage;
+
+	if (getControlStage(buffer, record, stage) == false)
+	{
+		return false;
+	}
+
+	if ((record.header.info & USBPCAP_INFO_PDO_TO_FDO) == 0)
+	{
+		if (stage != USBPCAP_CONTROL_STAGE_SETUP || record.payloadLength < 8)
+		{
+			return false;
+		}
+
+		const unsigned char* payload = &buffer[record.payloadOffset];
+		Pending* entry = nullptr;
+
+		// an IRP may be sent again once completed, its last SETUP counts
+		for (auto& candidate : pending)
+		{
+			if (candidate.valid && candidate.irpId == record.header.irpId)
+			{
+				entry = &candidate;
+				break;
+			}
+		}
+
+		if (entry == nullptr)
+		{
+			entry = &pending[next];
+			next = (next + 1) % CONTROL_REQUESTS_PENDING;
+		}
+
+		entry->irpId = record.header.irpId;
+		entry->setup.bmRequestType = payload[0];
+		entry->setup.bRequest = payload[1];
+		entry->setup.wValue = (USHORT)(payload[2] | (payload[3] << 8));
+		entry->setup.wIndex = (USHORT)(payload[4] | (payload[5] << 8));
+		entry->setup.wLength = (USHORT)(payload[6] | (payload[7] << 8));
+		entry->valid = true;
+		return false;
+	}
+
+	if (stage != USBPCAP_CONTROL_STAGE_COMPLETE)
+	{
+		return false;
+	}
+
+	for (auto& entry : pending)
+	{
+		if (entry.valid && entry.irpId == record.header.irpId)
+		{
+			setup = entry.setup;
+			entry.valid = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ControlRequests::clear()
+{
+	memset(pending, 0, sizeof(pending));
+	next = 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "CaptureRecord.h"
+
+#define CONTROL_REQUESTS_PENDING 16 // SETUP packets awaiting their completion
+
+#define CONTROL_REQUEST_SET_ADDRESS    0x05
+#define CONTROL_REQUEST_GET_DESCRIPTOR 0x06
+
+// Stage of a control transfer record, false when it has no USBPCAP_BUFFER_CONTROL_HEADER.
+inline bool getControlStage(const unsigned char* buffer, const CaptureRecord& record, UCHAR& stage)
+{
+	if (record.header.transfer != USBPCAP_TRANSFER_CONTROL || record.header.headerLen < sizeof(USBPCAP_BUFFER_CONTROL_HEADER))
+	{
+		return false;
+	}
+
+	stage = buffer[record.offset + sizeof(pcaprec_hdr_t) + sizeof(USBPCAP_BUFFER_PACKET_HEADER)];
+	return true;
+}
+
+struct ControlSetup
+{
+	UCHAR bmRequestType;
+	UCHAR bRequest;
+	USHORT wValue;
+	USHORT wIndex;
+	USHORT wLength;
+
+	// standard requests to the device
+	bool isGetDeviceDescriptor() const;
+	bool isSetAddress() const;
+};
+
+// Pairs the completion of a control transfer with its SETUP packet, both
+// records carry the same IRP id. One per root hub, fed in capture order.
+// Not synchronized.
+class ControlRequests
+{
+public:
+	ControlRequests();
+
+public:
+	// Returns true for a completion whose SETUP was seen, with setup filled in.
+	// The completion may still carry an error status.
+	bool observe(const unsigned char* buffer, const CaptureRecord& record, ControlSetup& setup);
+	void clear();
+
+private:
+	struct Pending
+	{
+		UINT64 irpId;
+		ControlSetup setup;
+		bool valid;
+	};
+
+	// oldest entry is overwritten when all are taken, its completion was lost
+	Pending pending[CONTROL_REQUESTS_PENDING];
+	size_t next;
+
+};
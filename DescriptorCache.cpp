@@ -0,0 +1,198 @@
+#include "DescriptorCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "descriptors.h"
+
+CachedConfiguration::CachedConfiguration(PUSB_DESCRIPTOR_REQUEST request, const USB_DEVICE_DESCRIPTOR& device, unsigned int generation)
+	: device(device), generation(generation)
+{
+	const UCHAR* begin = reinterpret_cast<const UCHAR*>(request);
+
+	raw.assign(begin, begin + sizeof(USB_DESCRIPTOR_REQUEST) + request->SetupPacket.wLength);
+
+	parsed.parse(getRequest()->Data, getLength());
+}
+
+PUSB_DESCRIPTOR_REQUEST CachedConfiguration::getRequest() const
+{
+	return (PUSB_DESCRIPTOR_REQUEST)raw.data();
+}
+
+PUSB_CONFIGURATION_DESCRIPTOR CachedConfiguration::getDescriptor() const
+{
+	return (PUSB_CONFIGURATION_DESCRIPTOR)getRequest()->Data;
+}
+
+USHORT CachedConfiguration::getLength() const
+{
+	return getRequest()->SetupPacket.wLength;
+}
+
+const ConfigDescriptor& CachedConfiguration::getParsed() const
+{
+	return parsed;
+}
+
+const USB_DEVICE_DESCRIPTOR& CachedConfiguration::getDeviceDescriptor() const
+{
+	return device;
+}
+
+unsigned int CachedConfiguration::getGeneration() const
+{
+	return generation;
+}
+
+DescriptorCache& DescriptorCache::instance()
+{
+	static DescriptorCache cache;
+	return cache;
+}
+
+std::shared_ptr<const CachedConfiguration> DescriptorCache::getConfiguration(HANDLE hub, ULONG port, USHORT roothub,
+	USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR desc)
+{
+	Generations generations;
+	UINT64 key;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		generations = currentGenerations(roothub, deviceAddress);
+		key = cacheKey(roothub, port, deviceAddress, generations.connection);
+
+		auto it = entries.find(key);
+		if (it != entries.end())
+		{
+			const auto& entry = it->second;
+
+			// a replug while nobody captured the root hub changes nothing but the descriptor
+			if (entry->getGeneration() == topologyGeneration &&
+				memcmp(&entry->getDeviceDescriptor(), desc, sizeof(USB_DEVICE_DESCRIPTOR)) == 0)
+			{
+				return entry;
+			}
+
+			entries.erase(it);
+		}
+	}
+
+	// slow devices must not block other lookups, query without the lock held
+	PUSB_DESCRIPTOR_REQUEST request = descriptors_get_config_descriptor(hub, port, 0);
+	if (request == NULL)
+	{
+		return nullptr;
+	}
+
+	auto entry = std::make_shared<const CachedConfiguration>(request, *desc, generations.topology);
+	free(request);
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	// the device or its root hub may have been invalidated meanwhile
+	if (currentGenerations(roothub, deviceAddress) == generations)
+	{
+		entries[key] = entry;
+	}
+
+	return entry;
+}
+
+std::shared_ptr<const CachedConfiguration> DescriptorCache::findConfiguration(USHORT roothub, USHORT deviceAddress)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	unsigned int connection = currentGenerations(roothub, deviceAddress).connection;
+
+	// device address is unique within a root hub, port is only part of the key
+	for (const auto& entry : entries)
+	{
+		if ((entry.first >> 48) == roothub &&
+			((entry.first >> 24) & 0xFF) == deviceAddress &&
+			(entry.first & 0xFFFFFF) == (connection & 0xFFFFFF) &&
+			entry.second->getGeneration() == topologyGeneration)
+		{
+			return entry.second;
+		}
+	}
+
+	return nullptr;
+}
+
+void DescriptorCache::invalidate()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	entries.clear();
+	topologyGeneration++;
+}
+
+void DescriptorCache::invalidate(USHORT roothub)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	erase(roothub, -1);
+	roothubGenerations[roothub]++;
+}
+
+void DescriptorCache::invalidate(USHORT roothub, USHORT deviceAddress)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	erase(roothub, deviceAddress);
+	connectionGenerations[connectionKey(roothub, deviceAddress)]++;
+}
+
+unsigned int DescriptorCache::generation()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return topologyGeneration;
+}
+
+bool DescriptorCache::Generations::operator==(const Generations& other) const
+{
+	return topology == other.topology && roothub == other.roothub && connection == other.connection;
+}
+
+DescriptorCache::Generations DescriptorCache::currentGenerations(USHORT roothub, USHORT deviceAddress)
+{
+	Generations generations;
+	generations.topology = topologyGeneration;
+
+	auto hub = roothubGenerations.find(roothub);
+	generations.roothub = (hub != roothubGenerations.end()) ? hub->second : 0;
+
+	auto connection = connectionGenerations.find(connectionKey(roothub, deviceAddress));
+	generations.connection = (connection != connectionGenerations.end()) ? connection->second : 0;
+
+	return generations;
+}
+
+void DescriptorCache::erase(USHORT roothub, int deviceAddress)
+{
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		if ((it->first >> 48) == roothub && (deviceAddress < 0 || ((it->first >> 24) & 0xFF) == (UINT64)deviceAddress))
+		{
+			it = entries.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+UINT64 DescriptorCache::cacheKey(USHORT roothub, ULONG port, USHORT deviceAddress, unsigned int connection)
+{
+	// hub ports and device addresses stay far below 16 and 8 bits
+	return ((UINT64)roothub << 48) | ((UINT64)(port & 0xFFFF) << 32) | ((UINT64)(deviceAddress & 0xFF) << 24) | (connection & 0xFFFFFF);
+}
+
+UINT32 DescriptorCache::connectionKey(USHORT roothub, USHORT deviceAddress)
+{
+	return ((UINT32)roothub << 16) | deviceAddress;
+}
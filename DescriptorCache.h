@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Windows.h>
+#include <Usbioctl.h>
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ConfigDescriptor.h"
+
+// Configuration descriptor as returned by IOCTL_USB_GET_DESCRIPTOR_FROM_NODE_CONNECTION
+// together with its parsed interface and endpoint tables.
+class CachedConfiguration
+{
+public:
+	CachedConfiguration(PUSB_DESCRIPTOR_REQUEST request, const USB_DEVICE_DESCRIPTOR& device, unsigned int generation);
+
+public:
+	PUSB_DESCRIPTOR_REQUEST getRequest() const;
+	PUSB_CONFIGURATION_DESCRIPTOR getDescriptor() const;
+	USHORT getLength() const;
+	const ConfigDescriptor& getParsed() const;
+
+	const USB_DEVICE_DESCRIPTOR& getDeviceDescriptor() const;
+	unsigned int getGeneration() const;
+
+private:
+	std::vector<UCHAR> raw; // USB_DESCRIPTOR_REQUEST followed by wTotalLength bytes
+	ConfigDescriptor parsed;
+	USB_DEVICE_DESCRIPTOR device;
+	unsigned int generation;
+
+};
+
+// Process-wide cache of configuration descriptors keyed by root hub, port,
+// device address and connection generation. invalidate() drops everything
+// on a topology change, invalidate(roothub) one root hub and
+// invalidate(roothub, address) a device that was re-enumerated, each by
+// advancing a generation so that fetches in flight don't store stale entries.
+class DescriptorCache
+{
+public:
+	static DescriptorCache& instance();
+
+	DescriptorCache(const DescriptorCache&) = delete;
+	DescriptorCache& operator=(const DescriptorCache&) = delete;
+
+public:
+	std::shared_ptr<const CachedConfiguration> getConfiguration(HANDLE hub, ULONG port, USHORT roothub,
+		USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR desc);
+	std::shared_ptr<const CachedConfiguration> findConfiguration(USHORT roothub, USHORT deviceAddress);
+
+	void invalidate();
+	void invalidate(USHORT roothub);
+	void invalidate(USHORT roothub, USHORT deviceAddress);
+
+	unsigned int generation();
+
+private:
+	DescriptorCache() = default;
+
+	struct Generations
+	{
+		unsigned int topology;
+		unsigned int roothub;
+		unsigned int connection;
+
+		bool operator==(const Generations& other) const;
+	};
+
+	// lock must be held
+	Generations currentGenerations(USHORT roothub, USHORT deviceAddress);
+	void erase(USHORT roothub, int deviceAddress);
+
+	static UINT64 cacheKey(USHORT roothub, ULONG port, USHORT deviceAddress, unsigned int connection);
+	static UINT32 connectionKey(USHORT roothub, USHORT deviceAddress);
+
+private:
+	std::mutex lock;
+
+	std::unordered_map<UINT64, std::shared_ptr<const CachedConfiguration>> entries;
+	unsigned int topologyGeneration = 0;
+	std::unordered_map<USHORT, unsigned int> roothubGenerations;
+	std::unordered_map<UINT32, unsigned int> connectionGenerations; // re-enumerations per address
+
+};
@@ -0,0 +1,112 @@
+#include "DeviceAddressSet.h"
+
+#include <string.h>
+
+#include "iocontrol.h"
+
+DeviceAddressSet::DeviceAddressSet()
+{
+	memset(&filter, 0, sizeof(filter));
+}
+
+DeviceAddressSet::DeviceAddressSet(const USBPCAP_ADDRESS_FILTER& filter)
+	: filter(filter)
+{
+}
+
+DeviceAddressSet DeviceAddressSet::all()
+{
+	DeviceAddressSet addresses;
+	addresses.setAll(true);
+
+	return addresses;
+}
+
+bool DeviceAddressSet::add(int address)
+{
+	return USBPcapSetDeviceFiltered(&filter, address) != FALSE;
+}
+
+bool DeviceAddressSet::remove(int address)
+{
+	return USBPcapClearDeviceFiltered(&filter, address) != FALSE;
+}
+
+bool DeviceAddressSet::contains(int address) const
+{
+	// USBPcapIsDeviceFiltered() treats invalid addresses as filtered and complains about them
+	if (address < 0 || address > MAX_DEVICE_ADDRESS)
+	{
+		return filter.filterAll != FALSE;
+	}
+
+	return USBPcapIsDeviceFiltered(const_cast<PUSBPCAP_ADDRESS_FILTER>(&filter), address) != FALSE;
+}
+
+void DeviceAddressSet::clear()
+{
+	memset(&filter, 0, sizeof(filter));
+}
+
+void DeviceAddressSet::setAll(bool all)
+{
+	filter.filterAll = all ? TRUE : FALSE;
+}
+
+bool DeviceAddressSet::isAll() const
+{
+	return filter.filterAll != FALSE;
+}
+
+bool DeviceAddressSet::empty() const
+{
+	return filter.filterAll == FALSE &&
+		(filter.addresses[0] | filter.addresses[1] | filter.addresses[2] | filter.addresses[3]) == 0;
+}
+
+int DeviceAddressSet::count() const
+{
+	if (filter.filterAll)
+	{
+		return MAX_DEVICE_ADDRESS + 1;
+	}
+
+	int count = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		for (UINT32 bits = filter.addresses[i]; bits != 0; bits &= bits - 1)
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+DeviceAddressSet& DeviceAddressSet::operator|=(const DeviceAddressSet& other)
+{
+	filter.filterAll |= other.filter.filterAll;
+
+	for (int i = 0; i < 4; i++)
+	{
+		filter.addresses[i] |= other.filter.addresses[i];
+	}
+
+	return *this;
+}
+
+bool DeviceAddressSet::operator==(const DeviceAddressSet& other) const
+{
+	return memcmp(&filter, &other.filter, sizeof(filter)) == 0;
+}
+
+bool DeviceAddressSet::operator!=(const DeviceAddressSet& other) const
+{
+	return !(*this == other);
+}
+
+const USBPCAP_ADDRESS_FILTER& DeviceAddressSet::getFilter() const
+{
+	return filter;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "USBPcap.h"
+
+#define MAX_DEVICE_ADDRESS 127
+
+// Device addresses of one root hub as programmed with IOCTL_USBPCAP_START_FILTERING.
+// Address 0 captures newly connected devices, filterAll captures every device
+// regardless of the individual bits.
+class DeviceAddressSet
+{
+public:
+	DeviceAddressSet();
+	DeviceAddressSet(const USBPCAP_ADDRESS_FILTER& filter);
+
+	static DeviceAddressSet all();
+
+public:
+	bool add(int address);
+	bool remove(int address);
+	bool contains(int address) const;
+
+	void clear();
+	void setAll(bool all);
+	bool isAll() const;
+
+	bool empty() const;
+	int count() const;
+
+	DeviceAddressSet& operator|=(const DeviceAddressSet& other);
+	bool operator==(const DeviceAddressSet& other) const;
+	bool operator!=(const DeviceAddressSet& other) const;
+
+	const USBPCAP_ADDRESS_FILTER& getFilter() const;
+
+private:
+	USBPCAP_ADDRESS_FILTER filter;
+
+};
@@ -0,0 +1,233 @@
+#include "DeviceIdentityMap.h"
+
+#include <string.h>
+
+#include "DescriptorCache.h"
+#include "descriptors.h"
+#include "FilterRegistry.h"
+
+#define IDENTITY_MASK       0x00FFFFFFFFFFFFFFULL
+#define GENERATION_SHIFT    56
+
+DeviceIdentityMap& DeviceIdentityMap::instance()
+{
+	static DeviceIdentityMap map;
+	return map;
+}
+
+DeviceIdentityMap::DeviceIdentityMap()
+{
+	for (USHORT bus = 0; bus < DEVICE_IDENTITY_BUSES; bus++)
+	{
+		clear(bus);
+	}
+}
+
+DeviceIdentity DeviceIdentityMap::lookup(USHORT bus, USHORT address) const
+{
+	if (bus >= DEVICE_IDENTITY_BUSES || address >= DEVICE_IDENTITY_ADDRESSES)
+	{
+		return unpack(0);
+	}
+
+	return unpack(buses[bus].slots[address].load(std::memory_order_acquire));
+}
+
+DeviceIdentity DeviceIdentityMap::lookup(const CaptureRecord& record) const
+{
+	return lookup(record.header.bus, record.header.device);
+}
+
+bool DeviceIdentityMap::seed(const std::string& filter)
+{
+	USBPCAP_ADDRESS_FILTER all;
+	int length = 0;
+
+	USHORT bus = FilterRegistry::roothubNumber(filter);
+
+	if (bus >= DEVICE_IDENTITY_BUSES || USBPcapInitAddressFilter(&all, NULL, TRUE) == FALSE)
+	{
+		return false;
+	}
+
+	unsigned char* pcap = (unsigned char*)descriptors_generate_pcap(filter.c_str(), &length, &all);
+	if (pcap == NULL)
+	{
+		return false;
+	}
+
+	// devices gone since the last capture keep no identity
+	clear(bus);
+
+	decodeRecords(pcap, length, 0, [this, pcap](const CaptureRecord& record) { observe(pcap, record); });
+
+	descriptors_free_pcap(pcap);
+	return true;
+}
+
+void DeviceIdentityMap::observe(const RecordBatch& batch)
+{
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		observe(batch.buffer, batch.records[i]);
+	}
+}
+
+void DeviceIdentityMap::observe(const unsigned char* buffer, const CaptureRecord& record)
+{
+	if (record.header.bus >= DEVICE_IDENTITY_BUSES || record.header.device >= DEVICE_IDENTITY_ADDRESSES)
+	{
+		return;
+	}
+
+	Bus& bus = buses[record.header.bus];
+	ControlSetup setup;
+
+	if (bus.requests.observe(buffer, record, setup) == false || record.header.status != 0)
+	{
+		return;
+	}
+
+	if (setup.isSetAddress())
+	{
+		USHORT address = setup.wValue & 0x7F;
+
+		if (address == 0)
+		{
+			return;
+		}
+
+		addresses++;
+
+		// identity is only known when the descriptor was read at the default address,
+		// either way another device has the address now
+		if (bus.defaultKnown)
+		{
+			bind(bus, address, bus.defaultIdentity);
+		}
+		else
+		{
+			forget(bus, address);
+		}
+
+		bus.defaultKnown = false;
+		return;
+	}
+
+	// first request at the default address reads just bMaxPacketSize0
+	if (setup.isGetDeviceDescriptor() == false || record.payloadLength < sizeof(USB_DEVICE_DESCRIPTOR))
+	{
+		return;
+	}
+
+	const unsigned char* payload = &buffer[record.payloadOffset];
+
+	if (payload[0] != sizeof(USB_DEVICE_DESCRIPTOR) || payload[1] != USB_DEVICE_DESCRIPTOR_TYPE)
+	{
+		return;
+	}
+
+	USB_DEVICE_DESCRIPTOR descriptor;
+	memcpy(&descriptor, payload, sizeof(descriptor));
+
+	descriptors++;
+
+	if (record.header.device == 0)
+	{
+		bus.defaultIdentity = pack(descriptor);
+		bus.defaultKnown = true;
+		return;
+	}
+
+	bind(bus, record.header.device, pack(descriptor));
+}
+
+void DeviceIdentityMap::clear(USHORT bus)
+{
+	if (bus >= DEVICE_IDENTITY_BUSES)
+	{
+		return;
+	}
+
+	for (auto& slot : buses[bus].slots)
+	{
+		slot.store(0, std::memory_order_release);
+	}
+
+	buses[bus].defaultIdentity = 0;
+	buses[bus].defaultKnown = false;
+	buses[bus].requests.clear();
+}
+
+DeviceIdentityStats DeviceIdentityMap::getStats()
+{
+	DeviceIdentityStats stats;
+	stats.descriptors = descriptors;
+	stats.addresses = addresses;
+	stats.rebinds = rebinds;
+
+	return stats;
+}
+
+UINT64 DeviceIdentityMap::pack(const USB_DEVICE_DESCRIPTOR& descriptor)
+{
+	return (UINT64)descriptor.idVendor |
+		((UINT64)descriptor.idProduct << 16) |
+		((UINT64)descriptor.bcdDevice << 32) |
+		((UINT64)descriptor.bDeviceClass << 48);
+}
+
+DeviceIdentity DeviceIdentityMap::unpack(UINT64 slot)
+{
+	DeviceIdentity identity;
+	identity.idVendor = (USHORT)slot;
+	identity.idProduct = (USHORT)(slot >> 16);
+	identity.bcdDevice = (USHORT)(slot >> 32);
+	identity.deviceClass = (UCHAR)(slot >> 48);
+	identity.generation = (UCHAR)(slot >> GENERATION_SHIFT);
+
+	return identity;
+}
+
+UINT64 DeviceIdentityMap::nextGeneration(UINT64 current)
+{
+	UINT64 generation = (current >> GENERATION_SHIFT) + 1;
+
+	return (generation > 0xFF) ? 1 : generation;
+}
+
+void DeviceIdentityMap::bind(Bus& bus, USHORT address, UINT64 identity)
+{
+	UINT64 current = bus.slots[address].load(std::memory_order_relaxed);
+	UINT64 generation = current >> GENERATION_SHIFT;
+
+	// drivers read the descriptor again and again, only another device is a change
+	if (current != 0 && (current & IDENTITY_MASK) == identity)
+	{
+		return;
+	}
+
+	// a device given the address before its descriptor was seen keeps the generation forget() gave it
+	if ((current & IDENTITY_MASK) != 0)
+	{
+		rebinds++;
+		generation = nextGeneration(current);
+
+		DescriptorCache::instance().invalidate((USHORT)(&bus - buses), address);
+	}
+	else if (generation == 0)
+	{
+		generation = 1;
+	}
+
+	bus.slots[address].store(identity | (generation << GENERATION_SHIFT), std::memory_order_release);
+}
+
+void DeviceIdentityMap::forget(Bus& bus, USHORT address)
+{
+	UINT64 current = bus.slots[address].load(std::memory_order_relaxed);
+
+	bus.slots[address].store(nextGeneration(current) << GENERATION_SHIFT, std::memory_order_release);
+
+	DescriptorCache::instance().invalidate((USHORT)(&bus - buses), address);
+}
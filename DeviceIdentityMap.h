@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Windows.h>
+#include <Usbioctl.h>
+
+#include <atomic>
+#include <string>
+
+#include "CaptureRecord.h"
+#include "ControlRequests.h"
+
+#define DEVICE_IDENTITY_BUSES     32  // root hubs, USBPcap1 to USBPcap31
+#define DEVICE_IDENTITY_ADDRESSES 128
+
+struct DeviceIdentity
+{
+	USHORT idVendor;
+	USHORT idProduct;
+	USHORT bcdDevice;
+	UCHAR deviceClass;
+	UCHAR generation; // changes when the address is given to another device, 0 before the first one
+
+	// a device may hold the address before its descriptor was seen
+	bool isKnown() const
+	{
+		return idVendor != 0 || idProduct != 0;
+	}
+};
+
+struct DeviceIdentityStats
+{
+	UINT64 descriptors; // device descriptors taken from the capture
+	UINT64 addresses;   // completed SET_ADDRESS requests
+	UINT64 rebinds;     // addresses that got another identity
+};
+
+// Process-wide (bus, address) to device identity table built from captured
+// enumeration traffic: device descriptors completed by GET_DESCRIPTOR and
+// SET_ADDRESS moving the device at the default address to its own one.
+// seed() feeds the descriptor preamble of the devices already connected.
+//
+// lookup() is lock-free and may be called from any thread. Each bus must be
+// written from one thread only, i.e. the reader of its root hub.
+class DeviceIdentityMap
+{
+public:
+	static DeviceIdentityMap& instance();
+
+	DeviceIdentityMap(const DeviceIdentityMap&) = delete;
+	DeviceIdentityMap& operator=(const DeviceIdentityMap&) = delete;
+
+public:
+	DeviceIdentity lookup(USHORT bus, USHORT address) const;
+	DeviceIdentity lookup(const CaptureRecord& record) const;
+
+	// Writer side, filter is the \\.\USBPcapN control device of the bus.
+	bool seed(const std::string& filter);
+	void observe(const RecordBatch& batch);
+	void observe(const unsigned char* buffer, const CaptureRecord& record);
+	void clear(USHORT bus);
+
+	DeviceIdentityStats getStats();
+
+private:
+	DeviceIdentityMap();
+
+	struct Bus
+	{
+		std::atomic<UINT64> slots[DEVICE_IDENTITY_ADDRESSES];
+
+		UINT64 defaultIdentity; // device at address 0 waiting for SET_ADDRESS
+		bool defaultKnown;
+		ControlRequests requests; // SET_ADDRESS and GET_DESCRIPTOR awaiting completion
+	};
+
+	static UINT64 pack(const USB_DEVICE_DESCRIPTOR& descriptor);
+	static DeviceIdentity unpack(UINT64 slot);
+	static UINT64 nextGeneration(UINT64 slot);
+
+	void bind(Bus& bus, USHORT address, UINT64 identity);
+	// address taken by a device of unknown identity
+	void forget(Bus& bus, USHORT address);
+
+private:
+	Bus buses[DEVICE_IDENTITY_BUSES];
+
+	std::atomic<UINT64> descriptors{ 0 };
+	std::atomic<UINT64> addresses{ 0 };
+	std::atomic<UINT64> rebinds{ 0 };
+
+};
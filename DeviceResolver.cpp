@@ -0,0 +1,165 @@
+#include "DeviceResolver.h"
+
+#include <stdio.h>
+
+#include "enum.h"
+#include "FilterRegistry.h"
+
+#define USB_LANGUAGE_ID_EN_US 0x0409
+
+struct ResolveContext
+{
+	const std::unordered_multimap<UINT32, size_t>* selectorIndex;
+	const std::vector<DeviceSelector>* selectors;
+
+	const std::string* filter;
+	USHORT roothub;
+	std::vector<DeviceMatch>* matches;
+};
+
+/* Reads string descriptor of the device connected to given hub port.
+ *
+ * Returns empty string when the descriptor is not available.
+ */
+static std::string get_string_descriptor(HANDLE hub, ULONG port, UCHAR index)
+{
+	UCHAR buffer[sizeof(USB_DESCRIPTOR_REQUEST) + 255];
+	PUSB_DESCRIPTOR_REQUEST request = (PUSB_DESCRIPTOR_REQUEST)buffer;
+	PUSB_STRING_DESCRIPTOR descriptor = (PUSB_STRING_DESCRIPTOR)(request->Data);
+	ULONG nBytesReturned = 0;
+
+	if (index == 0)
+	{
+		return std::string();
+	}
+
+	memset(buffer, 0, sizeof(buffer));
+	request->ConnectionIndex = port;
+	request->SetupPacket.bmRequest = 0x80; /* Device to Host */
+	request->SetupPacket.bRequest = 0x06; /* GET DESCRIPTOR */
+	request->SetupPacket.wValue = (USB_STRING_DESCRIPTOR_TYPE << 8) | index;
+	request->SetupPacket.wIndex = USB_LANGUAGE_ID_EN_US;
+	request->SetupPacket.wLength = 255;
+
+	if (!DeviceIoControl(hub, IOCTL_USB_GET_DESCRIPTOR_FROM_NODE_CONNECTION,
+						 request, sizeof(buffer), request, sizeof(buffer), &nBytesReturned, NULL))
+	{
+		fprintf(stderr, "Failed to get string descriptor - %d\n", GetLastError());
+		return std::string();
+	}
+
+	if (nBytesReturned < sizeof(USB_DESCRIPTOR_REQUEST) + 2 ||
+		descriptor->bDescriptorType != USB_STRING_DESCRIPTOR_TYPE ||
+		descriptor->bLength < 2)
+	{
+		return std::string();
+	}
+
+	int chars = (descriptor->bLength - 2) / sizeof(WCHAR);
+	int length = WideCharToMultiByte(CP_UTF8, 0, descriptor->bString, chars, NULL, 0, NULL, NULL);
+	if (length <= 0)
+	{
+		return std::string();
+	}
+
+	std::string result(length, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, descriptor->bString, chars, &result[0], length, NULL, NULL);
+
+	return result;
+}
+
+DeviceResolver::DeviceResolver(const std::vector<DeviceSelector>& selectors)
+{
+	for (const auto& selector : selectors)
+	{
+		addSelector(selector.idVendor, selector.idProduct, selector.serialNumber);
+	}
+}
+
+size_t DeviceResolver::addSelector(USHORT idVendor, USHORT idProduct, const std::string& serialNumber)
+{
+	size_t index = selectors.size();
+
+	selectors.push_back({ idVendor, idProduct, serialNumber });
+	selectorIndex.emplace(selectorKey(idVendor, idProduct), index);
+
+	return index;
+}
+
+const std::vector<DeviceSelector>& DeviceResolver::getSelectors() const
+{
+	return selectors;
+}
+
+std::vector<DeviceMatch> DeviceResolver::resolve() const
+{
+	std::vector<DeviceMatch> matches;
+
+	if (selectors.empty())
+	{
+		return matches;
+	}
+
+	auto matchConnectedDevice = [](HANDLE hub, ULONG port, USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR desc, void *ctx)
+	{
+		auto context = reinterpret_cast<ResolveContext*>(ctx);
+		if (context == nullptr) return;
+
+		auto range = context->selectorIndex->equal_range(selectorKey(desc->idVendor, desc->idProduct));
+		if (range.first == range.second) return;
+
+		// serial number costs another round-trip to the device, read it once per port
+		bool serialRead = false;
+		std::string serialNumber;
+
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			const DeviceSelector& selector = (*context->selectors)[it->second];
+
+			if (selector.serialNumber.empty() == false)
+			{
+				if (serialRead == false)
+				{
+					serialNumber = get_string_descriptor(hub, port, desc->iSerialNumber);
+					serialRead = true;
+				}
+
+				if (selector.serialNumber != serialNumber)
+				{
+					continue;
+				}
+			}
+
+			DeviceMatch match;
+			match.selector = it->second;
+			match.filter = *context->filter;
+			match.port = port;
+			match.deviceAddress = deviceAddress;
+			match.descriptor = *desc;
+			match.serialNumber = serialNumber;
+			match.configuration = DescriptorCache::instance().getConfiguration(hub, port, context->roothub, deviceAddress, desc);
+
+			context->matches->push_back(match);
+		}
+	};
+
+	ResolveContext context;
+	context.selectorIndex = &selectorIndex;
+	context.selectors = &selectors;
+	context.matches = &matches;
+
+	for (const auto& filter : FilterRegistry::instance().devices())
+	{
+		context.filter = &filter;
+		context.roothub = FilterRegistry::roothubNumber(filter);
+
+		enumerate_all_connected_devices(filter.c_str(), matchConnectedDevice, &context);
+	}
+
+	return matches;
+}
+
+UINT32 DeviceResolver::selectorKey(USHORT idVendor, USHORT idProduct)
+{
+	return ((UINT32)idVendor << 16) | idProduct;
+}
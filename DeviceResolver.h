@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Windows.h>
+#include <Usbioctl.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DescriptorCache.h"
+
+struct DeviceSelector
+{
+	USHORT idVendor;
+	USHORT idProduct;
+	std::string serialNumber; // empty matches any serial number
+};
+
+struct DeviceMatch
+{
+	size_t selector; // index of the matching DeviceSelector
+
+	std::string filter; // \\.\USBPcapN the device is attached to
+	ULONG port;
+	USHORT deviceAddress;
+
+	USB_DEVICE_DESCRIPTOR descriptor;
+	std::string serialNumber; // only read when a selector asks for it
+
+	// through DescriptorCache, nullptr when the device didn't answer
+	std::shared_ptr<const CachedConfiguration> configuration;
+};
+
+// Resolves any number of VID/PID (and optionally serial number) selectors
+// with a single walk over every hub of every root hub.
+class DeviceResolver
+{
+public:
+	DeviceResolver() = default;
+	explicit DeviceResolver(const std::vector<DeviceSelector>& selectors);
+
+public:
+	size_t addSelector(USHORT idVendor, USHORT idProduct, const std::string& serialNumber = std::string());
+	const std::vector<DeviceSelector>& getSelectors() const;
+
+	std::vector<DeviceMatch> resolve() const;
+
+private:
+	static UINT32 selectorKey(USHORT idVendor, USHORT idProduct);
+
+private:
+	std::vector<DeviceSelector> selectors;
+	std::unordered_multimap<UINT32, size_t> selectorIndex;
+
+};
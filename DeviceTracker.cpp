@@ -0,0 +1,97 @@
+#include "DeviceTracker.h"
+
+#include <string.h>
+
+#include <Usbioctl.h>
+
+void DeviceTracker::setTarget(USHORT idVendor, USHORT idProduct)
+{
+	this->idVendor = idVendor;
+	this->idProduct = idProduct;
+}
+
+void DeviceTracker::setAddress(USHORT address)
+{
+	this->address = address;
+}
+
+USHORT DeviceTracker::getAddress() const
+{
+	return address;
+}
+
+bool DeviceTracker::observe(const unsigned char* buffer, const CaptureRecord& record, USHORT& candidate)
+{
+	ControlSetup setup;
+
+	// SETUP packets of every device are needed to recognize the completions
+	if (requests.observe(buffer, record, setup) == false || setup.isGetDeviceDescriptor() == false)
+	{
+		return false;
+	}
+
+	// address 0 is the default address before SET_ADDRESS, not the final one
+	if (record.header.device == 0 || record.header.device == address || record.header.status != 0)
+	{
+		return false;
+	}
+
+	// partial reads of the first 8 bytes don't reach idVendor/idProduct
+	if (record.payloadLength < sizeof(USB_DEVICE_DESCRIPTOR))
+	{
+		return false;
+	}
+
+	USB_DEVICE_DESCRIPTOR descriptor;
+	memcpy(&descriptor, &buffer[record.payloadOffset], sizeof(descriptor));
+
+	if (descriptor.bLength != sizeof(USB_DEVICE_DESCRIPTOR) || descriptor.bDescriptorType != USB_DEVICE_DESCRIPTOR_TYPE)
+	{
+		return false;
+	}
+
+	descriptors++;
+
+	if (descriptor.idVendor != idVendor || descriptor.idProduct != idProduct)
+	{
+		return false;
+	}
+
+	if (record.header.device == rejectedAddress && record.timestamp < rejectedUntil)
+	{
+		return false;
+	}
+
+	candidates++;
+
+	candidate = record.header.device;
+	return true;
+}
+
+void DeviceTracker::retarget(USHORT address)
+{
+	this->address = address;
+
+	rejectedAddress = 0;
+
+	retargets++;
+}
+
+void DeviceTracker::reject(USHORT address, UINT64 timestamp)
+{
+	rejectedAddress = address;
+	rejectedUntil = timestamp + DEVICE_TRACKER_REJECT_TIME;
+
+	rejects++;
+}
+
+DeviceTrackerStats DeviceTracker::getStats()
+{
+	DeviceTrackerStats stats;
+	stats.descriptors = descriptors;
+	stats.candidates = candidates;
+	stats.retargets = retargets;
+	stats.rejects = rejects;
+
+	return stats;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+
+#include "CaptureRecord.h"
+#include "ControlRequests.h"
+
+// drivers repeat GET_DESCRIPTOR, a rejected candidate isn't reported again for this long
+#define DEVICE_TRACKER_REJECT_TIME (NSEC_PER_SEC)
+
+struct DeviceTrackerStats
+{
+	UINT64 descriptors; // device descriptors completed at other addresses
+	UINT64 candidates;  // of those, with the tracked VID/PID
+	UINT64 retargets;
+	UINT64 rejects;
+};
+
+// Follows a device across re-enumeration. Capture of newly connected devices
+// (address 0 bit of USBPCAP_ADDRESS_FILTER) shows the GET_DESCRIPTOR requests
+// its drivers issue at the new address, a completed GET_DESCRIPTOR(DEVICE)
+// with the tracked VID/PID there makes it a candidate.
+//
+// Not synchronized, configure before start() and observe from the reader thread.
+// Address and counters may be read at any time.
+class DeviceTracker
+{
+public:
+	DeviceTracker() = default;
+
+	DeviceTracker(const DeviceTracker&) = delete;
+	DeviceTracker& operator=(const DeviceTracker&) = delete;
+
+public:
+	void setTarget(USHORT idVendor, USHORT idProduct);
+	// current address of the target, its own traffic is not a re-enumeration
+	void setAddress(USHORT address);
+	USHORT getAddress() const;
+
+	// Returns true and the address when the target may have shown up elsewhere.
+	bool observe(const unsigned char* buffer, const CaptureRecord& record, USHORT& candidate);
+	// Called once a candidate was confirmed or turned out to be another device.
+	void retarget(USHORT address);
+	void reject(USHORT address, UINT64 timestamp);
+
+	DeviceTrackerStats getStats();
+
+private:
+	USHORT idVendor = 0;
+	USHORT idProduct = 0;
+	std::atomic<USHORT> address{ 0 }; // also read by getDeviceConfiguration() callers
+
+	ControlRequests requests;
+
+	USHORT rejectedAddress = 0;
+	UINT64 rejectedUntil = 0;
+
+	std::atomic<UINT64> descriptors{ 0 };
+	std::atomic<UINT64> candidates{ 0 };
+	std::atomic<UINT64> retargets{ 0 };
+	std::atomic<UINT64> rejects{ 0 };
+
+};
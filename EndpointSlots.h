@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <memory>
+
+#define ENDPOINT_SLOT_DEVICES 128
+#define ENDPOINT_SLOTS        32  // 16 OUT + 16 IN
+
+// endpoint number 0-15, +16 for IN
+inline UCHAR endpointSlot(UCHAR address)
+{
+	return (address & 0x0F) | ((address & 0x80) ? 0x10 : 0x00);
+}
+
+inline UCHAR slotEndpoint(UCHAR slot)
+{
+	return (slot & 0x0F) | ((slot & 0x10) ? 0x80 : 0x00);
+}
+
+// Per device address and endpoint state, indexed without hashing.
+// Slots are allocated on the heap, the table is too large to embed.
+// Not synchronized.
+template <class Slot>
+class EndpointSlotTable
+{
+public:
+	EndpointSlotTable()
+		: slots(new Slot[ENDPOINT_SLOT_DEVICES * ENDPOINT_SLOTS]())
+	{
+	}
+
+	EndpointSlotTable(const EndpointSlotTable&) = delete;
+	EndpointSlotTable& operator=(const EndpointSlotTable&) = delete;
+
+public:
+	static bool isCovered(USHORT device)
+	{
+		return device < ENDPOINT_SLOT_DEVICES;
+	}
+
+	// device must be covered
+	Slot& at(USHORT device, UCHAR endpoint)
+	{
+		return slots[device * ENDPOINT_SLOTS + endpointSlot(endpoint)];
+	}
+
+	// device/endpoint of -1 match all
+	template <class Function>
+	void forEach(int device, int endpoint, Function&& function)
+	{
+		int first = (device >= 0) ? device : 0;
+		int last = (device >= 0) ? device + 1 : ENDPOINT_SLOT_DEVICES;
+
+		for (int d = first; d < last && d < ENDPOINT_SLOT_DEVICES; d++)
+		{
+			for (int s = 0; s < ENDPOINT_SLOTS; s++)
+			{
+				UCHAR address = slotEndpoint((UCHAR)s);
+
+				if (endpoint >= 0 && address != (UCHAR)endpoint)
+				{
+					continue;
+				}
+
+				function(slots[d * ENDPOINT_SLOTS + s], (USHORT)d, address);
+			}
+		}
+	}
+
+	Slot* begin()
+	{
+		return slots.get();
+	}
+
+	Slot* end()
+	{
+		return slots.get() + ENDPOINT_SLOT_DEVICES * ENDPOINT_SLOTS;
+	}
+
+private:
+	std::unique_ptr<Slot[]> slots;
+
+};
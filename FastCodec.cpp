@@ -0,0 +1,215 @@
+#include "FastCodec.h"
+
+#include <string.h>
+
+#define FAST_HASH_LOG    12
+#define FAST_MIN_MATCH   4
+#define FAST_MAX_OFFSET  65535
+#define FAST_LAST_LITERALS 5  // trailing bytes always stored as literals
+#define FAST_MATCH_GUARD   12 // no match may start this close to the end
+#define FAST_RUN_MASK    15
+
+static inline UINT32 read32(const UCHAR* p)
+{
+	UINT32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline UINT32 hashSequence(UINT32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - FAST_HASH_LOG);
+}
+
+static inline UCHAR* writeLength(UCHAR* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (UCHAR)length;
+
+	return op;
+}
+
+static UCHAR* writeSequence(UCHAR* op, const UCHAR* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+	UCHAR* token = op++;
+	*token = 0;
+
+	if (literalLength >= FAST_RUN_MASK)
+	{
+		*token = FAST_RUN_MASK << 4;
+		op = writeLength(op, literalLength - FAST_RUN_MASK);
+	}
+	else
+	{
+		*token = (UCHAR)(literalLength << 4);
+	}
+
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+
+	if (matchLength == 0)
+	{
+		// last sequence has no match
+		return op;
+	}
+
+	*op++ = (UCHAR)(offset & 0xFF);
+	*op++ = (UCHAR)(offset >> 8);
+
+	matchLength -= FAST_MIN_MATCH;
+	if (matchLength >= FAST_RUN_MASK)
+	{
+		*token |= FAST_RUN_MASK;
+		op = writeLength(op, matchLength - FAST_RUN_MASK);
+	}
+	else
+	{
+		*token |= (UCHAR)matchLength;
+	}
+
+	return op;
+}
+
+size_t fastCompressBound(size_t srcSize)
+{
+	return srcSize + srcSize / 255 + 16;
+}
+
+size_t fastCompress(const UCHAR* src, size_t srcSize, UCHAR* dst, size_t dstCapacity)
+{
+	UINT32 table[1 << FAST_HASH_LOG];
+	size_t anchor = 0;
+	size_t ip = 0;
+	UCHAR* op = dst;
+
+	if (dstCapacity < fastCompressBound(srcSize))
+	{
+		return 0;
+	}
+
+	memset(table, 0, sizeof(table));
+
+	if (srcSize > FAST_MATCH_GUARD)
+	{
+		size_t matchLimit = srcSize - FAST_LAST_LITERALS;
+		size_t searchLimit = srcSize - FAST_MATCH_GUARD;
+
+		while (ip < searchLimit)
+		{
+			UINT32 sequence = read32(&src[ip]);
+			UINT32 hash = hashSequence(sequence);
+			size_t candidate = table[hash];
+
+			table[hash] = (UINT32)ip;
+
+			// entries start as 0, the byte comparison rejects stale hits
+			if (candidate >= ip || ip - candidate > FAST_MAX_OFFSET || read32(&src[candidate]) != sequence)
+			{
+				// skip faster through data that does not compress
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			size_t matchLength = FAST_MIN_MATCH;
+			while (ip + matchLength < matchLimit && src[candidate + matchLength] == src[ip + matchLength])
+			{
+				matchLength++;
+			}
+
+			op = writeSequence(op, &src[anchor], ip - anchor, ip - candidate, matchLength);
+
+			ip += matchLength;
+			anchor = ip;
+		}
+	}
+
+	op = writeSequence(op, &src[anchor], srcSize - anchor, 0, 0);
+
+	return op - dst;
+}
+
+static inline bool readLength(const UCHAR*& ip, const UCHAR* end, size_t& length)
+{
+	UCHAR value;
+
+	do
+	{
+		if (ip >= end)
+		{
+			return false;
+		}
+
+		value = *ip++;
+		length += value;
+	} while (value == 255);
+
+	return true;
+}
+
+bool fastDecompress(const UCHAR* src, size_t srcSize, UCHAR* dst, size_t dstSize)
+{
+	const UCHAR* ip = src;
+	const UCHAR* end = src + srcSize;
+	UCHAR* op = dst;
+	UCHAR* opEnd = dst + dstSize;
+
+	while (ip < end)
+	{
+		UCHAR token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == FAST_RUN_MASK && readLength(ip, end, literalLength) == false)
+		{
+			return false;
+		}
+
+		if (literalLength > (size_t)(end - ip) || literalLength > (size_t)(opEnd - op))
+		{
+			return false;
+		}
+
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		if (ip == end)
+		{
+			// literals-only sequence terminates the block
+			break;
+		}
+
+		if (end - ip < 2)
+		{
+			return false;
+		}
+
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		size_t matchLength = token & FAST_RUN_MASK;
+		if (matchLength == FAST_RUN_MASK && readLength(ip, end, matchLength) == false)
+		{
+			return false;
+		}
+		matchLength += FAST_MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(op - dst) || matchLength > (size_t)(opEnd - op))
+		{
+			return false;
+		}
+
+		// byte copy, source and destination may overlap for runs
+		const UCHAR* match = op - offset;
+		for (size_t i = 0; i < matchLength; i++)
+		{
+			op[i] = match[i];
+		}
+		op += matchLength;
+	}
+
+	return op == opEnd;
+}
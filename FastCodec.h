@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Windows.h>
+
+// Bundled LZ77 block codec in the spirit of LZ4: byte-aligned sequences of
+// literals followed by a 16-bit offset match. Fast enough to keep up with a
+// capture stream on one core, no external dependency.
+
+size_t fastCompressBound(size_t srcSize);
+
+// Returns compressed size, or 0 when dstCapacity is below fastCompressBound().
+size_t fastCompress(const UCHAR* src, size_t srcSize, UCHAR* dst, size_t dstCapacity);
+
+// Returns true when src decodes to exactly dstSize bytes.
+bool fastDecompress(const UCHAR* src, size_t srcSize, UCHAR* dst, size_t dstSize);
@@ -0,0 +1,82 @@
+#include "FilterRegistry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "DescriptorCache.h"
+#include "filters.h"
+
+FilterRegistry& FilterRegistry::instance()
+{
+	static FilterRegistry registry;
+	return registry;
+}
+
+std::vector<std::string> FilterRegistry::devices()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (valid == false)
+	{
+		discover();
+	}
+
+	return filterDevices;
+}
+
+bool FilterRegistry::refresh()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// root hubs may have come and gone, devices with them
+	DescriptorCache::instance().invalidate();
+
+	return discover();
+}
+
+void FilterRegistry::invalidate()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	DescriptorCache::instance().invalidate();
+
+	valid = false;
+}
+
+unsigned int FilterRegistry::generation()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return discoveryGeneration;
+}
+
+USHORT FilterRegistry::roothubNumber(const std::string& filter)
+{
+	// trailing number, as in descriptors_generate_pcap()
+	size_t digits = filter.find_last_not_of("0123456789") + 1;
+
+	return (USHORT)atoi(filter.c_str() + digits);
+}
+
+bool FilterRegistry::discover()
+{
+	// filters_initialize() works on a global list, lock is held by the caller
+	filters_initialize();
+
+	filterDevices.clear();
+
+	if (usbpcapFilters != NULL)
+	{
+		for (int i = 0; usbpcapFilters[i] != NULL; i++)
+		{
+			filterDevices.emplace_back(usbpcapFilters[i]->device);
+		}
+	}
+
+	filters_free();
+
+	valid = true;
+	discoveryGeneration++;
+
+	return filterDevices.empty() == false;
+}
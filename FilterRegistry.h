@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide list of USBPcap filter control devices (\\.\USBPcapN).
+// \Device is searched once; later lookups reuse the result until refresh()
+// is called or invalidate() signals a change (e.g. from WM_DEVICECHANGE),
+// which also drops the cached configuration descriptors.
+class FilterRegistry
+{
+public:
+	static FilterRegistry& instance();
+
+	FilterRegistry(const FilterRegistry&) = delete;
+	FilterRegistry& operator=(const FilterRegistry&) = delete;
+
+public:
+	std::vector<std::string> devices();
+	bool refresh();
+	void invalidate();
+
+	unsigned int generation();
+
+	// N of \\.\USBPcapN, the bus number in USBPcap packet headers
+	static USHORT roothubNumber(const std::string& filter);
+
+private:
+	FilterRegistry() = default;
+
+	bool discover();
+
+private:
+	std::mutex lock;
+
+	std::vector<std::string> filterDevices;
+	bool valid = false;
+	unsigned int discoveryGeneration = 0;
+
+};
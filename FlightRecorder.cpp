@@ -0,0 +1,444 @@
+#include "FlightRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "CaptureOutput.h"
+
+static UINT64 alignEntry(UINT64 length)
+{
+	return (length + FLIGHT_RECORDER_ALIGNMENT - 1) & ~(UINT64)(FLIGHT_RECORDER_ALIGNMENT - 1);
+}
+
+FlightRecorder::~FlightRecorder()
+{
+	close();
+}
+
+bool FlightRecorder::open(const std::string& path, UINT64 capacity, const FlightRecorderOptions& options, UINT32 snaplen)
+{
+	close();
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	capacity &= ~(UINT64)(FLIGHT_RECORDER_ALIGNMENT - 1);
+	if (capacity < 2 * (sizeof(FlightRecorderEntry) + sizeof(pcaprec_hdr_t) + snaplen))
+	{
+		printf("Flight recorder of %llu bytes can't hold records of %u bytes\n", capacity, snaplen);
+		return false;
+	}
+
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		printf("Couldn't open flight recorder %s: %d\n", path.c_str(), GetLastError());
+		return false;
+	}
+
+	UINT64 size = sizeof(FlightRecorderHeader) + capacity;
+	LARGE_INTEGER existing;
+
+	if (GetFileSizeEx(fileHandle, &existing) == FALSE)
+	{
+		existing.QuadPart = 0;
+	}
+
+	// grows the file to the mapped size
+	mapping = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+	if (mapping == NULL)
+	{
+		printf("CreateFileMapping failed with %d\n", GetLastError());
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	header = (FlightRecorderHeader*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size);
+	if (header == nullptr)
+	{
+		printf("MapViewOfFile failed with %d\n", GetLastError());
+		CloseHandle(mapping);
+		CloseHandle(fileHandle);
+		mapping = NULL;
+		fileHandle = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	data = (unsigned char*)(header + 1);
+
+	bool recovered = (UINT64)existing.QuadPart == size &&
+		header->magic == FLIGHT_RECORDER_MAGIC && header->version == FLIGHT_RECORDER_VERSION &&
+		header->capacity == capacity && header->tail <= header->head && header->head - header->tail <= capacity;
+
+	if (recovered == false)
+	{
+		memset(header, 0, sizeof(FlightRecorderHeader));
+		header->magic = FLIGHT_RECORDER_MAGIC;
+		header->version = FLIGHT_RECORDER_VERSION;
+		header->capacity = capacity;
+	}
+
+	header->snaplen = snaplen;
+
+	this->options = options;
+	stopping = false;
+	freezes = 0;
+	pending = false;
+	lastTimestamp = 0;
+
+	ThreadOptions exporterOptions = options.exporter;
+	if (exporterOptions.name.empty())
+	{
+		exporterOptions.name = "USBPcap flight recorder";
+	}
+
+	exporter = std::thread(&FlightRecorder::exportDumps, this, exporterOptions);
+	return true;
+}
+
+void FlightRecorder::close()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		if (header == nullptr)
+		{
+			return;
+		}
+
+		// a pending dump is written right away
+		stopping = true;
+	}
+
+	dumpRequested.notify_all();
+
+	if (exporter.joinable())
+	{
+		exporter.join();
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	FlushViewOfFile(header, 0);
+	UnmapViewOfFile(header);
+	CloseHandle(mapping);
+	CloseHandle(fileHandle);
+
+	header = nullptr;
+	data = nullptr;
+	mapping = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+}
+
+bool FlightRecorder::isOpen()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return header != nullptr;
+}
+
+void FlightRecorder::setTrigger(FlightTrigger match)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->match = std::move(match);
+}
+
+void FlightRecorder::setExportCallback(FlightExportCallback callback)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	exportCallback = std::move(callback);
+}
+
+void FlightRecorder::trigger()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (header != nullptr)
+	{
+		requestDump(lastTimestamp);
+	}
+}
+
+bool FlightRecorder::exportWindow(const std::string& path, UINT64 from)
+{
+	UINT64 tail;
+	UINT64 head;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		if (header == nullptr)
+		{
+			return false;
+		}
+
+		freezes++;
+		tail = header->tail;
+		head = header->head;
+	}
+
+	bool written = writeWindow(path, from, tail, head);
+
+	std::lock_guard<std::mutex> guard(lock);
+	freezes--;
+
+	return written;
+}
+
+void FlightRecorder::consume(const RecordBatch& batch)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (header == nullptr)
+	{
+		return;
+	}
+
+	if (freezes > 0)
+	{
+		frozenRecords += batch.count;
+		return;
+	}
+
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		const CaptureRecord& record = batch.records[i];
+
+		append(&batch.buffer[record.offset], sizeof(pcaprec_hdr_t) + record.record.incl_len);
+		lastTimestamp = record.timestamp;
+
+		// USBD_STATUS errors have the high bit set
+		if ((options.triggerOnError && (LONG)record.header.status < 0) ||
+			(match && match(record, &batch.buffer[record.payloadOffset])))
+		{
+			requestDump(record.timestamp);
+		}
+	}
+}
+
+FlightRecorderStats FlightRecorder::getStats()
+{
+	FlightRecorderStats stats;
+	stats.records = records;
+	stats.bytes = bytes;
+	stats.evicted = evicted;
+	stats.frozen = frozenRecords;
+	stats.rejected = rejected;
+	stats.triggers = triggers;
+	stats.exports = exports;
+
+	return stats;
+}
+
+void FlightRecorder::append(const unsigned char* record, UINT32 length)
+{
+	UINT64 capacity = header->capacity;
+	UINT64 size = alignEntry(sizeof(FlightRecorderEntry) + length);
+
+	if (size > capacity / 2)
+	{
+		rejected++;
+		return;
+	}
+
+	UINT64 head = header->head;
+	UINT64 tail = header->tail;
+
+	// entries never cross the end of the file, the rest of it is skipped
+	UINT64 remaining = capacity - head % capacity;
+	UINT64 skip = (remaining < size) ? remaining : 0;
+
+	while (head + skip + size - tail > capacity)
+	{
+		UINT64 oldestSize = entrySize(tail, head);
+
+		if (oldestSize == 0)
+		{
+			// damaged, e.g. recovered from a torn file, nothing older can be trusted
+			printf("Flight recorder entry at %llu is damaged, dropping older entries\n", tail);
+			tail = head;
+			break;
+		}
+
+		if ((entryAt(tail)->flags & FLIGHT_RECORDER_FLAG_WRAP) == 0)
+		{
+			evicted++;
+		}
+
+		tail += oldestSize;
+	}
+
+	// the file must never point at entries being overwritten, the mapping
+	// keeps this order when the process dies
+	header->tail = tail;
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (skip > 0)
+	{
+		FlightRecorderEntry* marker = entryAt(head);
+		marker->length = (UINT32)skip;
+		marker->flags = FLIGHT_RECORDER_FLAG_WRAP;
+
+		head += skip;
+	}
+
+	FlightRecorderEntry* entry = entryAt(head);
+	entry->length = length;
+	entry->flags = 0;
+	memcpy(entry + 1, record, length);
+
+	std::atomic_thread_fence(std::memory_order_release);
+	header->head = head + size;
+
+	records++;
+	bytes += length;
+}
+
+void FlightRecorder::requestDump(UINT64 timestamp)
+{
+	triggers++;
+
+	if (pending)
+	{
+		return;
+	}
+
+	pending = true;
+	triggerTimestamp = timestamp;
+
+	dumpRequested.notify_one();
+}
+
+void FlightRecorder::exportDumps(ThreadOptions threadOptions)
+{
+	HANDLE mmcssHandle = applyThreadOptions(threadOptions);
+
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (true)
+	{
+		dumpRequested.wait(guard, [this]() { return pending || stopping; });
+
+		if (pending == false)
+		{
+			break;
+		}
+
+		// traffic following the trigger belongs to the window as well
+		dumpRequested.wait_for(guard, std::chrono::nanoseconds(options.postTrigger), [this]() { return stopping; });
+
+		UINT64 from = (triggerTimestamp > options.preTrigger) ? triggerTimestamp - options.preTrigger : 0;
+		UINT64 tail = header->tail;
+		UINT64 head = header->head;
+		std::string path = options.exportPrefix + "-" + std::to_string(++dumps) + ".pcap";
+
+		freezes++;
+		guard.unlock();
+
+		bool written = writeWindow(path, from, tail, head);
+
+		guard.lock();
+		freezes--;
+		pending = false;
+
+		if (written)
+		{
+			exports++;
+		}
+
+		if (exportCallback)
+		{
+			FlightExportCallback callback = exportCallback;
+
+			guard.unlock();
+			callback(path, written);
+			guard.lock();
+		}
+	}
+
+	guard.unlock();
+
+	revertThreadOptions(mmcssHandle);
+}
+
+bool FlightRecorder::writeWindow(const std::string& path, UINT64 from, UINT64 tail, UINT64 head)
+{
+	FileOutput output;
+
+	if (output.open(path) == false)
+	{
+		return false;
+	}
+
+	pcap_hdr_t pcapHeader;
+	pcapHeader.magic_number = PCAP_MAGIC_NUMBER;
+	pcapHeader.version_major = 2;
+	pcapHeader.version_minor = 4;
+	pcapHeader.thiszone = 0;
+	pcapHeader.sigfigs = 0;
+	pcapHeader.snaplen = header->snaplen;
+	pcapHeader.network = DLT_USBPCAP;
+
+	bool written = output.write(&pcapHeader, sizeof(pcapHeader));
+
+	// ring is frozen, entries between tail and head stay as they are
+	for (UINT64 position = tail; written && position < head; )
+	{
+		FlightRecorderEntry* entry = entryAt(position);
+		UINT64 size = entrySize(position, head);
+
+		if (size == 0)
+		{
+			printf("Flight recorder entry at %llu is damaged, %s ends there\n", position, path.c_str());
+			break;
+		}
+
+		const pcaprec_hdr_t* record = (const pcaprec_hdr_t*)(entry + 1);
+
+		if ((entry->flags & FLIGHT_RECORDER_FLAG_WRAP) == 0 && pcapTimestampToNs(record->ts_sec, record->ts_usec) >= from)
+		{
+			written = output.write(record, entry->length);
+		}
+
+		position += size;
+	}
+
+	return output.close() && written;
+}
+
+UINT64 FlightRecorder::entrySize(UINT64 position, UINT64 head)
+{
+	FlightRecorderEntry* entry = entryAt(position);
+	UINT64 remaining = header->capacity - position % header->capacity;
+	UINT64 size;
+
+	if (entry->flags & FLIGHT_RECORDER_FLAG_WRAP)
+	{
+		size = entry->length;
+	}
+	else if (entry->length >= sizeof(pcaprec_hdr_t))
+	{
+		size = alignEntry(sizeof(FlightRecorderEntry) + entry->length);
+	}
+	else
+	{
+		return 0;
+	}
+
+	// entries never cross the end of the file or the head
+	if (size == 0 || size > remaining || position + size > head)
+	{
+		return 0;
+	}
+
+	return size;
+}
+
+FlightRecorderEntry* FlightRecorder::entryAt(UINT64 position)
+{
+	return (FlightRecorderEntry*)&data[position % header->capacity];
+}
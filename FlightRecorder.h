@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "RecordSink.h"
+#include "ThreadOptions.h"
+#include "Timestamp.h"
+
+#define FLIGHT_RECORDER_MAGIC       0x46425355 // "USBF"
+#define FLIGHT_RECORDER_VERSION     1
+#define FLIGHT_RECORDER_ALIGNMENT   8
+#define FLIGHT_RECORDER_FLAG_WRAP   (1 << 0)
+
+#define DEFAULT_FLIGHT_RECORDER_SIZE (256ULL*1024*1024)
+
+// Start of the file, kept current so that a recording survives the process.
+struct FlightRecorderHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT64 capacity; // data bytes following the header
+	UINT64 head;     // end of the newest entry, positions count from the first write
+	UINT64 tail;     // oldest entry
+	UINT32 snaplen;
+	UINT32 reserved[7];
+};
+
+// Entries are aligned: FlightRecorderEntry, pcap record header, USBPcap packet.
+struct FlightRecorderEntry
+{
+	UINT32 length; // record bytes, for a wrap marker the bytes skipped
+	UINT32 flags;
+};
+
+struct FlightRecorderOptions
+{
+	UINT64 preTrigger = 120 * NSEC_PER_SEC; // traffic before the trigger that is exported
+	UINT64 postTrigger = 5 * NSEC_PER_SEC;  // recording goes on this long before the freeze
+	bool triggerOnError = false;            // records completed with a USBD error status
+
+	std::string exportPrefix = "flight";    // dumps are <exportPrefix>-<n>.pcap
+	ThreadOptions exporter;
+};
+
+struct FlightRecorderStats
+{
+	UINT64 records;
+	UINT64 bytes;
+	UINT64 evicted;  // oldest records overwritten
+	UINT64 frozen;   // records not kept while a dump was being written
+	UINT64 rejected; // records larger than half the ring
+	UINT64 triggers;
+	UINT64 exports;
+};
+
+typedef std::function<bool(const CaptureRecord& record, const unsigned char* payload)> FlightTrigger;
+typedef std::function<void(const std::string& path, bool written)> FlightExportCallback;
+
+// Keeps the most recent traffic in a fixed-size memory-mapped circular file.
+// Records are copied into the mapping as they are, without allocating. A
+// trigger (trigger(), an error status or the pattern) lets recording go on
+// for postTrigger, then freezes the ring and writes the records from
+// preTrigger before the trigger onwards to a DLT_USBPCAP file on the
+// exporter thread. Triggers while a dump is pending are counted only.
+class FlightRecorder : public RecordSink
+{
+public:
+	FlightRecorder() = default;
+	~FlightRecorder();
+
+	FlightRecorder(const FlightRecorder&) = delete;
+	FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+public:
+	// An existing recording of the same capacity is continued.
+	bool open(const std::string& path, UINT64 capacity = DEFAULT_FLIGHT_RECORDER_SIZE,
+		const FlightRecorderOptions& options = FlightRecorderOptions(), UINT32 snaplen = 65535);
+	void close();
+	bool isOpen();
+
+	// pattern trigger, called for every record on the reader thread
+	void setTrigger(FlightTrigger match);
+	void setExportCallback(FlightExportCallback callback);
+
+	void trigger();
+	// Writes the records from the given record timestamp on, outside of the trigger handling.
+	bool exportWindow(const std::string& path, UINT64 from = 0);
+
+	void consume(const RecordBatch& batch) override;
+
+	FlightRecorderStats getStats();
+
+private:
+	void append(const unsigned char* data, UINT32 length);
+	void requestDump(UINT64 timestamp);
+	void exportDumps(ThreadOptions options);
+	bool writeWindow(const std::string& path, UINT64 from, UINT64 tail, UINT64 head);
+
+	// bytes taken by the entry at position, 0 when it is damaged
+	UINT64 entrySize(UINT64 position, UINT64 head);
+	FlightRecorderEntry* entryAt(UINT64 position);
+
+private:
+	std::mutex lock; // ring state, dump request
+	std::condition_variable dumpRequested;
+
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	FlightRecorderHeader* header = nullptr;
+	unsigned char* data = nullptr;
+
+	FlightRecorderOptions options;
+	FlightTrigger match;
+	FlightExportCallback exportCallback;
+
+	std::thread exporter;
+	bool stopping = false;
+	unsigned int freezes = 0; // dumps reading the ring, nothing is written meanwhile
+	bool pending = false;
+	UINT64 triggerTimestamp = 0;
+	UINT64 lastTimestamp = 0;
+	UINT64 dumps = 0;
+
+	std::atomic<UINT64> records{ 0 };
+	std::atomic<UINT64> bytes{ 0 };
+	std::atomic<UINT64> evicted{ 0 };
+	std::atomic<UINT64> frozenRecords{ 0 };
+	std::atomic<UINT64> rejected{ 0 };
+	std::atomic<UINT64> triggers{ 0 };
+	std::atomic<UINT64> exports{ 0 };
+
+};
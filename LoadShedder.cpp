@@ -0,0 +1,251 @@
+#include "LoadShedder.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+LoadShedder::LoadShedder()
+{
+	for (auto& slot : slots)
+	{
+		slot.shedClass = ShedClass::Default;
+	}
+}
+
+void LoadShedder::setOptions(const LoadShedderOptions& options)
+{
+	this->options = options;
+
+	if (this->options.sampleRate == 0)
+	{
+		this->options.sampleRate = 1;
+	}
+}
+
+bool LoadShedder::setRateLimit(int device, int endpoint, double recordsPerSecond, double burst)
+{
+	bool limited = true;
+
+	slots.forEach(device, endpoint, [&](Slot& slot, USHORT, UCHAR address)
+	{
+		if (recordsPerSecond > 0 && isCritical(slot, address))
+		{
+			// an explicit endpoint is reported, wildcards just pass over them
+			if (endpoint >= 0)
+			{
+				limited = false;
+			}
+
+			return;
+		}
+
+		setRate(slot, recordsPerSecond, burst);
+	});
+
+	if (limited == false)
+	{
+		printf("Endpoint 0x%02X is critical and is not rate limited\n", endpoint);
+	}
+
+	return limited;
+}
+
+void LoadShedder::setShedClass(int device, int endpoint, ShedClass shedClass)
+{
+	slots.forEach(device, endpoint, [&](Slot& slot, USHORT, UCHAR address)
+	{
+		slot.shedClass = shedClass;
+
+		if (isCritical(slot, address))
+		{
+			setRate(slot, 0, 0);
+		}
+	});
+}
+
+bool LoadShedder::isEnabled()
+{
+	return limitedSlots > 0 || options.sampleRate > 1;
+}
+
+size_t LoadShedder::apply(std::vector<CaptureRecord>& records, DWORD bytes, DWORD capacity)
+{
+	double fill = (capacity == 0) ? 0.0 : (double)bytes / capacity;
+	int level = 0;
+
+	if (fill >= options.severeFill)
+	{
+		level = 2;
+		severeBatches.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if (fill >= options.overloadFill || options.alwaysSample)
+	{
+		level = 1;
+	}
+
+	if (fill >= options.overloadFill)
+	{
+		overloadedBatches.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (options.sampleRate <= 1)
+	{
+		level = 0;
+	}
+
+	batches.fetch_add(1, std::memory_order_relaxed);
+
+	if (level == 0 && limitedSlots == 0)
+	{
+		seen.fetch_add(records.size(), std::memory_order_relaxed);
+		kept.fetch_add(records.size(), std::memory_order_relaxed);
+		return records.size();
+	}
+
+	size_t count = 0;
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const CaptureRecord& record = records[i];
+
+		if (slots.isCovered(record.header.device) == false ||
+			accept(slots.at(record.header.device, record.header.endpoint), record, level))
+		{
+			if (count != i)
+			{
+				records[count] = record;
+			}
+
+			count++;
+		}
+	}
+
+	seen.fetch_add(records.size(), std::memory_order_relaxed);
+	kept.fetch_add(count, std::memory_order_relaxed);
+
+	records.resize(count);
+	return count;
+}
+
+LoadShedderStats LoadShedder::getStats()
+{
+	LoadShedderStats stats;
+	stats.seen = seen.load(std::memory_order_relaxed);
+	stats.kept = kept.load(std::memory_order_relaxed);
+	stats.sampledOut = sampledOut.load(std::memory_order_relaxed);
+	stats.rateLimited = rateLimited.load(std::memory_order_relaxed);
+
+	for (int i = 0; i < 3; i++)
+	{
+		stats.shed[i] = shed[i].load(std::memory_order_relaxed);
+	}
+
+	stats.batches = batches.load(std::memory_order_relaxed);
+	stats.overloadedBatches = overloadedBatches.load(std::memory_order_relaxed);
+	stats.severeBatches = severeBatches.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+UINT64 LoadShedder::getShed(USHORT device, UCHAR endpoint)
+{
+	if (slots.isCovered(device) == false)
+	{
+		return 0;
+	}
+
+	return slots.at(device, endpoint).shed.load(std::memory_order_relaxed);
+}
+
+bool LoadShedder::accept(Slot& slot, const CaptureRecord& record, int level)
+{
+	ShedClass shedClass = (slot.shedClass == ShedClass::Default) ? classify(record) : slot.shedClass;
+
+	if (shedClass == ShedClass::Critical)
+	{
+		return true;
+	}
+
+	if (slot.rate > 0 && takeToken(slot, record.timestamp) == false)
+	{
+		rateLimited.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if ((shedClass == ShedClass::Bulk && level >= 1) || (shedClass == ShedClass::Normal && level >= 2))
+	{
+		// counter per endpoint keeps sparse endpoints represented
+		if (slot.sampleCounter++ % options.sampleRate == 0)
+		{
+			return true;
+		}
+
+		sampledOut.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		return true;
+	}
+
+	slot.shed.fetch_add(1, std::memory_order_relaxed);
+	shed[(int)shedClass].fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+bool LoadShedder::takeToken(Slot& slot, UINT64 timestamp)
+{
+	if (timestamp > slot.lastRefill)
+	{
+		if (slot.lastRefill != 0)
+		{
+			slot.tokens = std::min(slot.burst, slot.tokens + (timestamp - slot.lastRefill) * slot.rate / NSEC_PER_SEC);
+		}
+
+		slot.lastRefill = timestamp;
+	}
+
+	if (slot.tokens < 1.0)
+	{
+		return false;
+	}
+
+	slot.tokens -= 1.0;
+	return true;
+}
+
+void LoadShedder::setRate(Slot& slot, double recordsPerSecond, double burst)
+{
+	if (slot.rate == 0 && recordsPerSecond > 0)
+	{
+		limitedSlots++;
+	}
+	else if (slot.rate > 0 && recordsPerSecond <= 0)
+	{
+		limitedSlots--;
+	}
+
+	slot.rate = std::max(recordsPerSecond, 0.0);
+	slot.burst = std::max(burst, std::max(slot.rate / 10, 1.0));
+	slot.tokens = slot.burst;
+	slot.lastRefill = 0;
+}
+
+bool LoadShedder::isCritical(const Slot& slot, UCHAR endpoint)
+{
+	// endpoint 0 is the default control pipe
+	return slot.shedClass == ShedClass::Critical || (slot.shedClass == ShedClass::Default && (endpoint & 0x0F) == 0);
+}
+
+ShedClass LoadShedder::classify(const CaptureRecord& record)
+{
+	switch (record.header.transfer)
+	{
+	case USBPCAP_TRANSFER_BULK:
+		return ShedClass::Bulk;
+
+	case USBPCAP_TRANSFER_INTERRUPT:
+	case USBPCAP_TRANSFER_ISOCHRONOUS:
+		return ShedClass::Normal;
+
+	default:
+		return ShedClass::Critical;
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <vector>
+
+#include "CaptureRecord.h"
+#include "EndpointSlots.h"
+
+// Order in which traffic is given up under overload.
+enum class ShedClass
+{
+	Critical, // never shed, default for control transfers
+	Normal,   // shed under severe overload, default for interrupt and isochronous
+	Bulk,     // shed first, default for bulk transfers
+	Default,  // derive from the transfer type
+};
+
+struct LoadShedderOptions
+{
+	UINT32 sampleRate = 1;     // keep 1 in N records of a shed class, 1 disables sampling
+	double overloadFill = 0.5; // read buffer fill ratio shedding Bulk
+	double severeFill = 0.9;   // read buffer fill ratio shedding Normal as well
+	bool alwaysSample = false; // sample without waiting for overload
+};
+
+struct LoadShedderStats
+{
+	UINT64 seen;
+	UINT64 kept;
+	UINT64 sampledOut;  // dropped by overload sampling
+	UINT64 rateLimited; // dropped by a token bucket
+	UINT64 shed[3];     // dropped per ShedClass
+
+	UINT64 batches;
+	UINT64 overloadedBatches;
+	UINT64 severeBatches;
+};
+
+// Load shedding in the capture path: the fill ratio of every read buffer
+// tells how far the reader lags behind the driver. Above overloadFill, Bulk
+// records are sampled down to 1 in sampleRate, above severeFill Normal ones
+// as well. Independently, token buckets cap the record rate of selected
+// endpoints. Critical records always pass. Shed counts are kept per class
+// and per endpoint so that sampled statistics can be scaled back.
+//
+// Configuration is not synchronized with apply(), set it up before start().
+class LoadShedder
+{
+public:
+	LoadShedder();
+
+	LoadShedder(const LoadShedder&) = delete;
+	LoadShedder& operator=(const LoadShedder&) = delete;
+
+public:
+	void setOptions(const LoadShedderOptions& options);
+
+	// device/endpoint of -1 match all; recordsPerSecond of 0 removes the cap.
+	// Critical endpoints (endpoint 0 unless classed otherwise) are never
+	// limited, returns false when the given endpoint is one of them.
+	bool setRateLimit(int device, int endpoint, double recordsPerSecond, double burst = 0);
+	// Classing an endpoint Critical removes its rate limit.
+	void setShedClass(int device, int endpoint, ShedClass shedClass);
+	bool isEnabled();
+
+	// Drops shed records from the vector in place, returns the number kept.
+	size_t apply(std::vector<CaptureRecord>& records, DWORD bytes, DWORD capacity);
+
+	LoadShedderStats getStats();
+	UINT64 getShed(USHORT device, UCHAR endpoint);
+
+private:
+	struct Slot
+	{
+		double rate;       // tokens per second, 0 if unlimited
+		double burst;
+		double tokens;
+		UINT64 lastRefill; // record timestamp of the last refill
+
+		ShedClass shedClass;
+		UINT32 sampleCounter;
+
+		std::atomic<UINT64> shed;
+	};
+
+	bool accept(Slot& slot, const CaptureRecord& record, int level);
+	bool takeToken(Slot& slot, UINT64 timestamp);
+	void setRate(Slot& slot, double recordsPerSecond, double burst);
+
+	static bool isCritical(const Slot& slot, UCHAR endpoint);
+	static ShedClass classify(const CaptureRecord& record);
+
+private:
+	LoadShedderOptions options;
+	EndpointSlotTable<Slot> slots;
+	size_t limitedSlots = 0;
+
+	std::atomic<UINT64> seen{ 0 };
+	std::atomic<UINT64> kept{ 0 };
+	std::atomic<UINT64> sampledOut{ 0 };
+	std::atomic<UINT64> rateLimited{ 0 };
+	std::atomic<UINT64> shed[3] = {};
+
+	std::atomic<UINT64> batches{ 0 };
+	std::atomic<UINT64> overloadedBatches{ 0 };
+	std::atomic<UINT64> severeBatches{ 0 };
+
+};
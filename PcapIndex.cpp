@@ -0,0 +1,289 @@
+#include "PcapIndex.h"
+
+#include "CompressedOutput.h"
+#include "EndpointSlots.h"
+
+UINT32 endpointIndexBit(UCHAR endpoint)
+{
+	return 1u << endpointSlot(endpoint);
+}
+
+// addresses above 127 don't occur on USB, they share the bit of address & 0x7F
+static USHORT deviceIndexAddress(USHORT device)
+{
+	return device & 0x7F;
+}
+
+PcapIndexWriter::~PcapIndexWriter()
+{
+	close();
+}
+
+bool PcapIndexWriter::open(const std::string& path, UINT32 blockRecords)
+{
+	close();
+
+	if (blockRecords == 0)
+	{
+		return false;
+	}
+
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Couldn't create index file %s\n", path.c_str());
+		return false;
+	}
+
+	PcapIndexHeader header = {};
+	header.magic = PCAP_INDEX_MAGIC;
+	header.version = PCAP_INDEX_VERSION;
+	header.blockRecords = blockRecords;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+	{
+		fprintf(stderr, "Couldn't write index file header\n");
+		close();
+		return false;
+	}
+
+	this->blockRecords = blockRecords;
+	memset(&block, 0, sizeof(block));
+
+	return true;
+}
+
+void PcapIndexWriter::close()
+{
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	flushBlock();
+
+	fclose(file);
+	file = nullptr;
+}
+
+void PcapIndexWriter::addRecord(UINT64 fileOffset, const CaptureRecord& record)
+{
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	if (block.recordCount == 0)
+	{
+		block.fileOffset = fileOffset;
+		block.minTimestamp = record.timestamp;
+		block.maxTimestamp = record.timestamp;
+	}
+
+	// timestamps of different IRPs are not strictly ordered
+	if (record.timestamp < block.minTimestamp)
+	{
+		block.minTimestamp = record.timestamp;
+	}
+	if (record.timestamp > block.maxTimestamp)
+	{
+		block.maxTimestamp = record.timestamp;
+	}
+
+	USHORT device = deviceIndexAddress(record.header.device);
+	block.deviceBitmap[device / 32] |= 1u << (device % 32);
+	block.endpointBitmap |= endpointIndexBit(record.header.endpoint);
+
+	if (++block.recordCount == blockRecords)
+	{
+		flushBlock();
+	}
+}
+
+void PcapIndexWriter::flushBlock()
+{
+	if (block.recordCount == 0)
+	{
+		return;
+	}
+
+	if (fwrite(&block, sizeof(block), 1, file) != 1)
+	{
+		fprintf(stderr, "Couldn't write index block\n");
+	}
+
+	memset(&block, 0, sizeof(block));
+}
+
+PcapIndexReader::~PcapIndexReader()
+{
+	close();
+}
+
+bool PcapIndexReader::open(const std::string& capturePath)
+{
+	return open(capturePath, capturePath + PCAP_INDEX_EXTENSION);
+}
+
+bool PcapIndexReader::open(const std::string& capturePath, const std::string& indexPath)
+{
+	close();
+
+	FILE* index = fopen(indexPath.c_str(), "rb");
+	if (index == nullptr)
+	{
+		fprintf(stderr, "Couldn't open index file %s\n", indexPath.c_str());
+		return false;
+	}
+
+	PcapIndexHeader header;
+	if (fread(&header, sizeof(header), 1, index) != 1 ||
+		header.magic != PCAP_INDEX_MAGIC || header.version != PCAP_INDEX_VERSION)
+	{
+		fprintf(stderr, "Invalid index file %s\n", indexPath.c_str());
+		fclose(index);
+		return false;
+	}
+
+	PcapIndexBlock block;
+	while (fread(&block, sizeof(block), 1, index) == 1)
+	{
+		blocks.push_back(block);
+	}
+	fclose(index);
+
+	bool opened;
+
+	if (CompressedInput::isCompressed(capturePath))
+	{
+		CompressedInput* input = new CompressedInput();
+		capture.reset(input);
+		opened = input->open(capturePath);
+	}
+	else
+	{
+		FileInput* input = new FileInput();
+		capture.reset(input);
+		opened = input->open(capturePath);
+	}
+
+	if (opened == false)
+	{
+		fprintf(stderr, "Couldn't open capture file %s\n", capturePath.c_str());
+		capture.reset();
+		blocks.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void PcapIndexReader::close()
+{
+	capture.reset();
+
+	blocks.clear();
+}
+
+const std::vector<PcapIndexBlock>& PcapIndexReader::getBlocks() const
+{
+	return blocks;
+}
+
+std::vector<size_t> PcapIndexReader::findBlocks(const PcapIndexQuery& query) const
+{
+	std::vector<size_t> found;
+
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		if (blockMatches(blocks[i], query))
+		{
+			found.push_back(i);
+		}
+	}
+
+	return found;
+}
+
+long long PcapIndexReader::query(const PcapIndexQuery& query, const RecordCallback& callback)
+{
+	long long delivered = 0;
+
+	if (capture == nullptr)
+	{
+		return -1;
+	}
+
+	for (size_t i : findBlocks(query))
+	{
+		const PcapIndexBlock& block = blocks[i];
+
+		if (capture->seek(block.fileOffset) == false)
+		{
+			return -1;
+		}
+
+		for (UINT32 n = 0; n < block.recordCount; n++)
+		{
+			pcaprec_hdr_t header;
+
+			if (capture->read(&header, sizeof(header)) == false)
+			{
+				return -1;
+			}
+
+			// record header and packet in one buffer, as read from the driver
+			packet.resize(sizeof(header) + header.incl_len);
+			memcpy(packet.data(), &header, sizeof(header));
+
+			if (header.incl_len > 0 &&
+				capture->read(&packet[sizeof(header)], header.incl_len) == false)
+			{
+				return -1;
+			}
+
+			decodeRecords(packet.data(), (DWORD)packet.size(), 0, [&](const CaptureRecord& record)
+			{
+				if (recordMatches(record, query))
+				{
+					callback(record, packet.data());
+					delivered++;
+				}
+			});
+		}
+	}
+
+	return delivered;
+}
+
+bool PcapIndexReader::blockMatches(const PcapIndexBlock& block, const PcapIndexQuery& query)
+{
+	if (block.maxTimestamp < query.from || block.minTimestamp > query.to)
+	{
+		return false;
+	}
+
+	if (query.device >= 0)
+	{
+		USHORT device = deviceIndexAddress((USHORT)query.device);
+
+		if ((block.deviceBitmap[device / 32] & (1u << (device % 32))) == 0)
+		{
+			return false;
+		}
+	}
+
+	if (query.endpoint >= 0 && (block.endpointBitmap & endpointIndexBit((UCHAR)query.endpoint)) == 0)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool PcapIndexReader::recordMatches(const CaptureRecord& record, const PcapIndexQuery& query)
+{
+	return record.timestamp >= query.from && record.timestamp <= query.to &&
+		(query.device < 0 || record.header.device == query.device) &&
+		(query.endpoint < 0 || record.header.endpoint == query.endpoint);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CaptureOutput.h"
+#include "CaptureRecord.h"
+
+#define PCAP_INDEX_MAGIC        0x58444950 // "PIDX"
+#define PCAP_INDEX_VERSION      1
+#define PCAP_INDEX_EXTENSION    ".idx"
+#define DEFAULT_INDEX_BLOCK_RECORDS 4096
+
+#pragma pack(push, 1)
+struct PcapIndexHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 blockRecords; // records per block, last block may hold less
+	UINT32 reserved;
+};
+
+struct PcapIndexBlock
+{
+	UINT64 fileOffset;   // capture file offset of the first record header
+	UINT64 minTimestamp; // ns since Unix epoch
+	UINT64 maxTimestamp;
+	UINT32 recordCount;
+	UINT32 deviceBitmap[4]; // USB addresses 0-127, same layout as USBPCAP_ADDRESS_FILTER
+	UINT32 endpointBitmap;  // endpoint number 0-15, +16 for IN endpoints
+};
+#pragma pack(pop)
+
+struct PcapIndexQuery
+{
+	int device = -1;   // -1 matches any device
+	int endpoint = -1; // -1 matches any endpoint
+	UINT64 from = 0;
+	UINT64 to = ~0ULL;
+};
+
+// Sidecar index written next to a capture file: one PcapIndexBlock every
+// blockRecords records, so readers can skip blocks that cannot match.
+class PcapIndexWriter
+{
+public:
+	PcapIndexWriter() = default;
+	~PcapIndexWriter();
+
+	PcapIndexWriter(const PcapIndexWriter&) = delete;
+	PcapIndexWriter& operator=(const PcapIndexWriter&) = delete;
+
+public:
+	bool open(const std::string& path, UINT32 blockRecords = DEFAULT_INDEX_BLOCK_RECORDS);
+	void close();
+
+	void addRecord(UINT64 fileOffset, const CaptureRecord& record);
+
+private:
+	void flushBlock();
+
+private:
+	FILE* file = nullptr;
+
+	UINT32 blockRecords = DEFAULT_INDEX_BLOCK_RECORDS;
+	PcapIndexBlock block = {};
+
+};
+
+// Capture file reader that only reads blocks the index says can match.
+class PcapIndexReader
+{
+public:
+	typedef std::function<void(const CaptureRecord& record, const unsigned char* packet)> RecordCallback;
+
+	PcapIndexReader() = default;
+	~PcapIndexReader();
+
+	PcapIndexReader(const PcapIndexReader&) = delete;
+	PcapIndexReader& operator=(const PcapIndexReader&) = delete;
+
+public:
+	// compressed captures are detected by their file header
+	bool open(const std::string& capturePath);
+	bool open(const std::string& capturePath, const std::string& indexPath);
+	void close();
+
+	const std::vector<PcapIndexBlock>& getBlocks() const;
+	std::vector<size_t> findBlocks(const PcapIndexQuery& query) const;
+
+	// Returns number of records passed to callback, or -1 on read error.
+	long long query(const PcapIndexQuery& query, const RecordCallback& callback);
+
+private:
+	static bool blockMatches(const PcapIndexBlock& block, const PcapIndexQuery& query);
+	static bool recordMatches(const CaptureRecord& record, const PcapIndexQuery& query);
+
+private:
+	std::unique_ptr<CaptureInput> capture;
+	std::vector<PcapIndexBlock> blocks;
+	std::vector<unsigned char> packet;
+
+};
+
+UINT32 endpointIndexBit(UCHAR endpoint);
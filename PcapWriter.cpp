@@ -0,0 +1,164 @@
+#include "PcapWriter.h"
+
+PcapWriter::~PcapWriter()
+{
+	close();
+}
+
+bool PcapWriter::open(const std::string& path, UINT32 snaplen, UINT32 indexBlockRecords)
+{
+	close();
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::unique_ptr<FileOutput> output(new FileOutput());
+	if (output->open(path) == false)
+	{
+		return false;
+	}
+
+	if (compression)
+	{
+		compressed = new CompressedOutput(std::move(output), compressionBlockSize);
+		file.reset(compressed);
+
+		if (compressed->start() == false)
+		{
+			file.reset();
+			compressed = nullptr;
+			return false;
+		}
+	}
+	else
+	{
+		file = std::move(output);
+	}
+
+	pcap_hdr_t header;
+	header.magic_number = PCAP_MAGIC_NUMBER;
+	header.version_major = 2;
+	header.version_minor = 4;
+	header.thiszone = 0;
+	header.sigfigs = 0;
+	header.snaplen = snaplen;
+	header.network = DLT_USBPCAP;
+
+	offset = 0;
+	records = 0;
+	compressionStats = CompressionStats();
+
+	if (write(&header, sizeof(header)) == false)
+	{
+		file.reset();
+		compressed = nullptr;
+		return false;
+	}
+
+	if (indexBlockRecords > 0 &&
+		index.open(path + PCAP_INDEX_EXTENSION, indexBlockRecords) == false)
+	{
+		// capture is still usable without the index
+		fprintf(stderr, "Capture %s is written without index\n", path.c_str());
+	}
+
+	return true;
+}
+
+void PcapWriter::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	index.close();
+
+	if (file->close() == false)
+	{
+		fprintf(stderr, "Couldn't finish capture file\n");
+	}
+
+	// keep the totals of the finished file readable
+	if (compressed != nullptr)
+	{
+		compressionStats = compressed->getStats();
+	}
+
+	file.reset();
+	compressed = nullptr;
+}
+
+bool PcapWriter::isOpen()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return file != nullptr;
+}
+
+void PcapWriter::consume(const RecordBatch& batch)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		const CaptureRecord& record = batch.records[i];
+		UINT64 recordOffset = offset;
+
+		if (write(&batch.buffer[record.offset], sizeof(pcaprec_hdr_t) + record.record.incl_len) == false)
+		{
+			return;
+		}
+
+		// only records that made it into the file are indexed
+		index.addRecord(recordOffset, record);
+
+		records++;
+	}
+}
+
+void PcapWriter::setCompression(bool enabled, DWORD blockSize)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	compression = enabled;
+	compressionBlockSize = blockSize;
+}
+
+CompressionStats PcapWriter::getCompressionStats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return (compressed != nullptr) ? compressed->getStats() : compressionStats;
+}
+
+UINT64 PcapWriter::getBytesWritten()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return offset;
+}
+
+UINT64 PcapWriter::getRecordsWritten()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return records;
+}
+
+bool PcapWriter::write(const void* data, size_t length)
+{
+	if (file->write(data, length) == false)
+	{
+		return false;
+	}
+
+	offset += length;
+	return true;
+}
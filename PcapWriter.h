@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Windows.h>
+#include <stdio.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "CaptureOutput.h"
+#include "CompressedOutput.h"
+#include "PcapIndex.h"
+#include "RecordSink.h"
+
+// Writes every captured record to a DLT_USBPCAP file, optionally with a
+// sidecar block index (<path>.idx). With compression enabled the capture
+// is framed by CompressedOutput, index offsets stay uncompressed offsets.
+class PcapWriter : public RecordSink
+{
+public:
+	PcapWriter() = default;
+	~PcapWriter();
+
+	PcapWriter(const PcapWriter&) = delete;
+	PcapWriter& operator=(const PcapWriter&) = delete;
+
+public:
+	// indexBlockRecords of 0 disables the index
+	bool open(const std::string& path, UINT32 snaplen = 65535, UINT32 indexBlockRecords = DEFAULT_INDEX_BLOCK_RECORDS);
+	void close();
+	bool isOpen();
+
+	// takes effect on the next open()
+	void setCompression(bool enabled, DWORD blockSize = DEFAULT_COMPRESSION_BLOCK_SIZE);
+	CompressionStats getCompressionStats();
+
+	void consume(const RecordBatch& batch) override;
+
+	UINT64 getBytesWritten();
+	UINT64 getRecordsWritten();
+
+private:
+	bool write(const void* data, size_t length);
+
+private:
+	std::mutex lock;
+
+	std::unique_ptr<CaptureOutput> file;
+	CompressedOutput* compressed = nullptr;
+	PcapIndexWriter index;
+
+	bool compression = false;
+	DWORD compressionBlockSize = DEFAULT_COMPRESSION_BLOCK_SIZE;
+	CompressionStats compressionStats = {};
+
+	UINT64 offset = 0;
+	UINT64 records = 0;
+
+};
@@ -0,0 +1,287 @@
+#include "RecordFilter.h"
+
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "USBPcap.h"
+
+#define CPUID_SSE41_BIT   (1 << 19) // leaf 1, ECX
+#define CPUID_OSXSAVE_BIT (1 << 27) // leaf 1, ECX
+#define CPUID_AVX_BIT     (1 << 28) // leaf 1, ECX
+#define CPUID_AVX2_BIT    (1 << 5)  // leaf 7, EBX
+
+#define XCR0_SSE_AVX_STATE 0x6
+
+RecordFilter::RecordFilter(const RecordPredicate& predicate)
+	: predicate(predicate), kernel(detectKernel())
+{
+}
+
+RecordFilterKernel RecordFilter::detectKernel()
+{
+	static const RecordFilterKernel detected = []()
+	{
+		int info[4];
+
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		bool sse41 = (info[2] & CPUID_SSE41_BIT) != 0;
+		bool avx = (info[2] & CPUID_AVX_BIT) != 0 && (info[2] & CPUID_OSXSAVE_BIT) != 0;
+
+		// AVX registers must also be saved by the OS
+		if (avx && (_xgetbv(0) & XCR0_SSE_AVX_STATE) != XCR0_SSE_AVX_STATE)
+		{
+			avx = false;
+		}
+
+		if (avx && maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			if (info[1] & CPUID_AVX2_BIT)
+			{
+				return RecordFilterKernel::AVX2;
+			}
+		}
+
+		return sse41 ? RecordFilterKernel::SSE41 : RecordFilterKernel::Scalar;
+	}();
+
+	return detected;
+}
+
+void RecordFilter::setPredicate(const RecordPredicate& predicate)
+{
+	this->predicate = predicate;
+}
+
+const RecordPredicate& RecordFilter::getPredicate() const
+{
+	return predicate;
+}
+
+void RecordFilter::setKernel(RecordFilterKernel kernel)
+{
+	// never pick an instruction set the CPU does not have
+	this->kernel = (kernel > detectKernel()) ? detectKernel() : kernel;
+}
+
+RecordFilterKernel RecordFilter::getKernel() const
+{
+	return kernel;
+}
+
+size_t RecordFilter::evaluate(const RecordIndex& index, std::vector<UINT64>& selection) const
+{
+	size_t count = index.size();
+	size_t done = 0;
+
+	selection.assign((count + 63) / 64, 0);
+
+	switch (kernel)
+	{
+	case RecordFilterKernel::AVX2:
+		done = evaluateAVX2(index, selection.data());
+		break;
+
+	case RecordFilterKernel::SSE41:
+		done = evaluateSSE41(index, selection.data());
+		break;
+
+	default:
+		break;
+	}
+
+	evaluateScalar(index, done, count, selection.data());
+
+	size_t selected = 0;
+	for (UINT64 word : selection)
+	{
+		selected += (size_t)__popcnt64(word);
+	}
+
+	return selected;
+}
+
+size_t RecordFilter::select(const RecordIndex& index, std::vector<CaptureRecord>& records, std::vector<UINT64>& selection) const
+{
+	size_t selected = evaluate(index, selection);
+
+	if (selected == records.size())
+	{
+		return selected;
+	}
+
+	size_t count = 0;
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		if (selection[i / 64] & (1ULL << (i % 64)))
+		{
+			if (count != i)
+			{
+				records[count] = records[i];
+			}
+
+			count++;
+		}
+	}
+
+	records.resize(count);
+	return count;
+}
+
+bool RecordFilter::accept(const RecordIndex& index, size_t i) const
+{
+	if (predicate.device != RECORD_ANY_DEVICE && index.device[i] != predicate.device)
+	{
+		return false;
+	}
+
+	if (predicate.endpoint != RECORD_ANY_ENDPOINT && index.endpoint[i] != predicate.endpoint)
+	{
+		return false;
+	}
+
+	if (predicate.transferMask != RECORD_TRANSFER_ANY &&
+		(index.transfer[i] > USBPCAP_TRANSFER_BULK ||
+		(predicate.transferMask & RECORD_TRANSFER_BIT(index.transfer[i])) == 0))
+	{
+		return false;
+	}
+
+	return index.payloadLength[i] >= predicate.minLength &&
+		index.payloadLength[i] <= predicate.maxLength;
+}
+
+void RecordFilter::evaluateScalar(const RecordIndex& index, size_t begin, size_t end, UINT64* selection) const
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		if (accept(index, i))
+		{
+			selection[i / 64] |= 1ULL << (i % 64);
+		}
+	}
+}
+
+// Both vector kernels widen every column to 32-bit lanes so that one
+// comparison mask covers the same records for all predicates.
+
+size_t RecordFilter::evaluateSSE41(const RecordIndex& index, UINT64* selection) const
+{
+	size_t count = index.size() & ~(size_t)3;
+
+	const __m128i device = _mm_set1_epi32(predicate.device);
+	const __m128i endpoint = _mm_set1_epi32(predicate.endpoint);
+	const __m128i minLength = _mm_set1_epi32((int)predicate.minLength);
+	const __m128i maxLength = _mm_set1_epi32((int)predicate.maxLength);
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128i mask = _mm_set1_epi32(-1);
+
+		if (predicate.device != RECORD_ANY_DEVICE)
+		{
+			__m128i devices = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)&index.device[i]));
+			mask = _mm_and_si128(mask, _mm_cmpeq_epi32(devices, device));
+		}
+
+		if (predicate.endpoint != RECORD_ANY_ENDPOINT)
+		{
+			int packed;
+			memcpy(&packed, &index.endpoint[i], sizeof(packed));
+
+			__m128i endpoints = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+			mask = _mm_and_si128(mask, _mm_cmpeq_epi32(endpoints, endpoint));
+		}
+
+		if (predicate.transferMask != RECORD_TRANSFER_ANY)
+		{
+			int packed;
+			memcpy(&packed, &index.transfer[i], sizeof(packed));
+
+			__m128i transfers = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+			__m128i matched = _mm_setzero_si128();
+
+			for (int transfer = 0; transfer <= USBPCAP_TRANSFER_BULK; transfer++)
+			{
+				if (predicate.transferMask & RECORD_TRANSFER_BIT(transfer))
+				{
+					matched = _mm_or_si128(matched, _mm_cmpeq_epi32(transfers, _mm_set1_epi32(transfer)));
+				}
+			}
+
+			mask = _mm_and_si128(mask, matched);
+		}
+
+		if (predicate.minLength != 0 || predicate.maxLength != 0xFFFFFFFF)
+		{
+			// unsigned range check: x == max(x, lo) && x == min(x, hi)
+			__m128i lengths = _mm_loadu_si128((const __m128i*)&index.payloadLength[i]);
+			mask = _mm_and_si128(mask, _mm_cmpeq_epi32(lengths, _mm_max_epu32(lengths, minLength)));
+			mask = _mm_and_si128(mask, _mm_cmpeq_epi32(lengths, _mm_min_epu32(lengths, maxLength)));
+		}
+
+		UINT64 bits = (UINT64)_mm_movemask_ps(_mm_castsi128_ps(mask));
+		selection[i / 64] |= bits << (i % 64);
+	}
+
+	return count;
+}
+
+size_t RecordFilter::evaluateAVX2(const RecordIndex& index, UINT64* selection) const
+{
+	size_t count = index.size() & ~(size_t)7;
+
+	const __m256i device = _mm256_set1_epi32(predicate.device);
+	const __m256i endpoint = _mm256_set1_epi32(predicate.endpoint);
+	const __m256i minLength = _mm256_set1_epi32((int)predicate.minLength);
+	const __m256i maxLength = _mm256_set1_epi32((int)predicate.maxLength);
+
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256i mask = _mm256_set1_epi32(-1);
+
+		if (predicate.device != RECORD_ANY_DEVICE)
+		{
+			__m256i devices = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&index.device[i]));
+			mask = _mm256_and_si256(mask, _mm256_cmpeq_epi32(devices, device));
+		}
+
+		if (predicate.endpoint != RECORD_ANY_ENDPOINT)
+		{
+			__m256i endpoints = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&index.endpoint[i]));
+			mask = _mm256_and_si256(mask, _mm256_cmpeq_epi32(endpoints, endpoint));
+		}
+
+		if (predicate.transferMask != RECORD_TRANSFER_ANY)
+		{
+			__m256i transfers = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&index.transfer[i]));
+			__m256i matched = _mm256_setzero_si256();
+
+			for (int transfer = 0; transfer <= USBPCAP_TRANSFER_BULK; transfer++)
+			{
+				if (predicate.transferMask & RECORD_TRANSFER_BIT(transfer))
+				{
+					matched = _mm256_or_si256(matched, _mm256_cmpeq_epi32(transfers, _mm256_set1_epi32(transfer)));
+				}
+			}
+
+			mask = _mm256_and_si256(mask, matched);
+		}
+
+		if (predicate.minLength != 0 || predicate.maxLength != 0xFFFFFFFF)
+		{
+			__m256i lengths = _mm256_loadu_si256((const __m256i*)&index.payloadLength[i]);
+			mask = _mm256_and_si256(mask, _mm256_cmpeq_epi32(lengths, _mm256_max_epu32(lengths, minLength)));
+			mask = _mm256_and_si256(mask, _mm256_cmpeq_epi32(lengths, _mm256_min_epu32(lengths, maxLength)));
+		}
+
+		UINT64 bits = (UINT64)_mm256_movemask_ps(_mm256_castsi256_ps(mask));
+		selection[i / 64] |= bits << (i % 64);
+	}
+
+	return count;
+}
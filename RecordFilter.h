@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <vector>
+
+#include "RecordIndex.h"
+
+#define RECORD_ANY_DEVICE   (-1)
+#define RECORD_ANY_ENDPOINT (-1)
+
+// transferMask bits, (1 << USBPCAP_TRANSFER_*) for the four USB transfer types
+#define RECORD_TRANSFER_BIT(transfer) (1 << (transfer))
+#define RECORD_TRANSFER_ANY           0xFF // also matches IRP info and unknown records
+
+struct RecordPredicate
+{
+	int device = RECORD_ANY_DEVICE;
+	int endpoint = RECORD_ANY_ENDPOINT;
+	UCHAR transferMask = RECORD_TRANSFER_ANY;
+
+	UINT32 minLength = 0;
+	UINT32 maxLength = 0xFFFFFFFF;
+};
+
+enum class RecordFilterKernel
+{
+	Scalar,
+	SSE41,
+	AVX2
+};
+
+// Evaluates a predicate over the columns of a RecordIndex and produces a
+// selection bitmap (bit i of word i / 64 set when record i matches).
+// The vector kernel is picked at runtime from CPUID.
+class RecordFilter
+{
+public:
+	explicit RecordFilter(const RecordPredicate& predicate = RecordPredicate());
+
+public:
+	static RecordFilterKernel detectKernel();
+
+	void setPredicate(const RecordPredicate& predicate);
+	const RecordPredicate& getPredicate() const;
+
+	// forcing a kernel is meant for comparing implementations
+	void setKernel(RecordFilterKernel kernel);
+	RecordFilterKernel getKernel() const;
+
+	size_t evaluate(const RecordIndex& index, std::vector<UINT64>& selection) const;
+	// Drops the records not matching from the vector in place, index must have
+	// been built from them. Returns the number kept.
+	size_t select(const RecordIndex& index, std::vector<CaptureRecord>& records, std::vector<UINT64>& selection) const;
+
+private:
+	void evaluateScalar(const RecordIndex& index, size_t begin, size_t end, UINT64* selection) const;
+	size_t evaluateSSE41(const RecordIndex& index, UINT64* selection) const;
+	size_t evaluateAVX2(const RecordIndex& index, UINT64* selection) const;
+
+	bool accept(const RecordIndex& index, size_t i) const;
+
+private:
+	RecordPredicate predicate;
+	RecordFilterKernel kernel;
+
+};
@@ -0,0 +1,46 @@
+#include "RecordIndex.h"
+
+void RecordIndex::build(const RecordBatch& batch)
+{
+	size_t count = batch.count;
+
+	timestamp.resize(count);
+	device.resize(count);
+	endpoint.resize(count);
+	transfer.resize(count);
+	function.resize(count);
+	status.resize(count);
+	payloadOffset.resize(count);
+	payloadLength.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const CaptureRecord& record = batch.records[i];
+
+		timestamp[i] = record.timestamp;
+		device[i] = record.header.device;
+		endpoint[i] = record.header.endpoint;
+		transfer[i] = record.header.transfer;
+		function[i] = record.header.function;
+		status[i] = record.header.status;
+		payloadOffset[i] = record.payloadOffset;
+		payloadLength[i] = record.payloadLength;
+	}
+}
+
+void RecordIndex::clear()
+{
+	timestamp.clear();
+	device.clear();
+	endpoint.clear();
+	transfer.clear();
+	function.clear();
+	status.clear();
+	payloadOffset.clear();
+	payloadLength.clear();
+}
+
+size_t RecordIndex::size() const
+{
+	return timestamp.size();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Windows.h>
+#include <malloc.h>
+
+#include <new>
+#include <vector>
+
+#include "CaptureRecord.h"
+
+#define RECORD_INDEX_ALIGNMENT 64
+
+template <class T, size_t Alignment>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	template <class U>
+	struct rebind
+	{
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+
+	AlignedAllocator() = default;
+
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		void* memory = _aligned_malloc(count * sizeof(T), Alignment);
+		if (memory == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		return static_cast<T*>(memory);
+	}
+
+	void deallocate(T* memory, size_t)
+	{
+		_aligned_free(memory);
+	}
+
+	template <class U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const
+	{
+		return true;
+	}
+
+	template <class U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const
+	{
+		return false;
+	}
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, RECORD_INDEX_ALIGNMENT>>;
+
+// Structure-of-arrays view of one read buffer: entry i of every column
+// describes records[i] of the batch. Columns start cache line aligned and
+// keep their capacity between buffers.
+struct RecordIndex
+{
+	void build(const RecordBatch& batch);
+	void clear();
+
+	size_t size() const;
+
+	AlignedVector<UINT64> timestamp;     // ns since Unix epoch
+	AlignedVector<USHORT> device;
+	AlignedVector<UCHAR>  endpoint;
+	AlignedVector<UCHAR>  transfer;
+	AlignedVector<USHORT> function;
+	AlignedVector<LONG>   status;
+	AlignedVector<UINT32> payloadOffset;
+	AlignedVector<UINT32> payloadLength;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "CaptureRecord.h"
+
+// Receives every parsed read buffer on the reader thread, before
+// USBPcapHelper::processBatch(). Buffer memory is only valid during the call.
+class RecordSink
+{
+public:
+	virtual ~RecordSink() = default;
+
+public:
+	virtual void consume(const RecordBatch& batch) = 0;
+};
@@ -0,0 +1,418 @@
+#include "SharedRing.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint64_t alignEntry(uint64_t length)
+{
+	return (length + SHARED_RING_ALIGNMENT - 1) & ~(uint64_t)(SHARED_RING_ALIGNMENT - 1);
+}
+
+SharedRingMapping::~SharedRingMapping()
+{
+	close();
+}
+
+bool SharedRingMapping::create(const std::string& name, size_t size)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		(DWORD)((UINT64)size >> 32), (DWORD)size, name.c_str());
+	if (mapping == NULL)
+	{
+		fprintf(stderr, "Couldn't create shared ring %s - %d\n", name.c_str(), GetLastError());
+		return false;
+	}
+
+	// another writer owns the name, its ring must not be reinitialized
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		fprintf(stderr, "Shared ring %s already exists\n", name.c_str());
+		CloseHandle(mapping);
+		return false;
+	}
+
+	view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (view == NULL)
+	{
+		fprintf(stderr, "Couldn't map shared ring %s - %d\n", name.c_str(), GetLastError());
+		CloseHandle(mapping);
+		return false;
+	}
+
+	handle = mapping;
+#else
+	std::string path = "/" + name;
+
+	int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, size) != 0)
+	{
+		fprintf(stderr, "Couldn't create shared ring %s\n", name.c_str());
+
+		if (fd >= 0)
+		{
+			::close(fd);
+			shm_unlink(path.c_str());
+		}
+
+		return false;
+	}
+
+	view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (view == MAP_FAILED)
+	{
+		fprintf(stderr, "Couldn't map shared ring %s\n", name.c_str());
+		view = nullptr;
+		shm_unlink(path.c_str());
+		return false;
+	}
+
+	unlinkName = path;
+#endif
+
+	this->size = size;
+	return true;
+}
+
+bool SharedRingMapping::open(const std::string& name)
+{
+	close();
+
+	// readers map read-write as well, 64-bit atomics may need it on 32-bit targets
+#ifdef _WIN32
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (mapping == NULL)
+	{
+		fprintf(stderr, "Couldn't open shared ring %s - %d\n", name.c_str(), GetLastError());
+		return false;
+	}
+
+	view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (view == NULL)
+	{
+		fprintf(stderr, "Couldn't map shared ring %s - %d\n", name.c_str(), GetLastError());
+		CloseHandle(mapping);
+		return false;
+	}
+
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(view, &info, sizeof(info));
+
+	handle = mapping;
+	size = info.RegionSize;
+#else
+	std::string path = "/" + name;
+
+	int fd = shm_open(path.c_str(), O_RDWR, 0);
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "Couldn't open shared ring %s\n", name.c_str());
+
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+
+		return false;
+	}
+
+	view = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (view == MAP_FAILED)
+	{
+		fprintf(stderr, "Couldn't map shared ring %s\n", name.c_str());
+		view = nullptr;
+		return false;
+	}
+
+	size = st.st_size;
+#endif
+
+	if (size < sizeof(SharedRingHeader) ||
+		header()->magic != SHARED_RING_MAGIC || header()->version != SHARED_RING_VERSION ||
+		header()->capacity > size - sizeof(SharedRingHeader))
+	{
+		fprintf(stderr, "%s is not a shared record ring\n", name.c_str());
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void SharedRingMapping::close()
+{
+	if (view == nullptr)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+	CloseHandle((HANDLE)handle);
+#else
+	munmap(view, size);
+
+	if (unlinkName.empty() == false)
+	{
+		shm_unlink(unlinkName.c_str());
+	}
+#endif
+
+	view = nullptr;
+	handle = nullptr;
+	size = 0;
+	unlinkName.clear();
+}
+
+SharedRingWriter::~SharedRingWriter()
+{
+	close();
+}
+
+bool SharedRingWriter::create(const std::string& name, size_t capacity)
+{
+	close();
+
+	uint64_t size = 64 * 1024;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	if (mapping.create(name, (size_t)(sizeof(SharedRingHeader) + size)) == false)
+	{
+		return false;
+	}
+
+	SharedRingHeader* header = mapping.header();
+	header->capacity = size;
+	header->reserved = 0;
+	header->committed = 0;
+	header->oldest = 0;
+	header->closed = 0;
+	header->version = SHARED_RING_VERSION;
+
+	// readers check the magic last
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = SHARED_RING_MAGIC;
+
+	position = 0;
+	oldest = 0;
+	stats = SharedRingStats();
+
+	return true;
+}
+
+void SharedRingWriter::close()
+{
+	if (mapping.header() != nullptr)
+	{
+		mapping.header()->closed.store(1, std::memory_order_release);
+	}
+
+	mapping.close();
+}
+
+bool SharedRingWriter::isOpen()
+{
+	return mapping.header() != nullptr;
+}
+
+bool SharedRingWriter::write(const void* data, uint32_t length)
+{
+	SharedRingHeader* header = mapping.header();
+	if (header == nullptr)
+	{
+		return false;
+	}
+
+	uint64_t capacity = header->capacity;
+	uint64_t size = alignEntry(sizeof(SharedRingEntry) + length);
+
+	if (size > capacity / 4)
+	{
+		return false;
+	}
+
+	uint64_t offset = position & (capacity - 1);
+	uint64_t skip = (offset + size > capacity) ? capacity - offset : 0;
+	uint64_t end = position + skip + size;
+
+	// entries about to be overwritten leave the ring
+	while (oldest + capacity < end)
+	{
+		SharedRingEntry last;
+		memcpy(&last, &mapping.data()[oldest & (capacity - 1)], sizeof(last));
+
+		oldest += (last.flags & SHARED_RING_FLAG_WRAP) ? last.length : alignEntry(sizeof(SharedRingEntry) + last.length);
+	}
+
+	header->oldest.store(oldest, std::memory_order_relaxed);
+	header->reserved.store(end, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (skip > 0)
+	{
+		SharedRingEntry marker = { (uint32_t)skip, SHARED_RING_FLAG_WRAP, stats.entries };
+		memcpy(&mapping.data()[offset], &marker, sizeof(marker));
+
+		position += skip;
+		offset = 0;
+	}
+
+	SharedRingEntry entry = { length, 0, stats.entries };
+	memcpy(&mapping.data()[offset], &entry, sizeof(entry));
+	memcpy(&mapping.data()[offset + sizeof(entry)], data, length);
+
+	position += size;
+	stats.entries++;
+	stats.bytes += length;
+
+	header->committed.store(position, std::memory_order_release);
+
+	return true;
+}
+
+SharedRingStats SharedRingWriter::getStats()
+{
+	return stats;
+}
+
+bool SharedRingReader::open(const std::string& name, bool fromOldest)
+{
+	close();
+
+	if (mapping.open(name) == false)
+	{
+		return false;
+	}
+
+	stats = SharedRingStats();
+	synced = false;
+
+	if (fromOldest)
+	{
+		// may be overwritten before the first read, read() then skips ahead
+		cursor = mapping.header()->oldest.load(std::memory_order_acquire);
+	}
+	else
+	{
+		skipToNewest();
+	}
+
+	return true;
+}
+
+void SharedRingReader::close()
+{
+	mapping.close();
+}
+
+bool SharedRingReader::read(std::vector<uint8_t>& entry)
+{
+	SharedRingHeader* header = mapping.header();
+	if (header == nullptr)
+	{
+		return false;
+	}
+
+	uint64_t capacity = header->capacity;
+
+	while (true)
+	{
+		uint64_t committed = header->committed.load(std::memory_order_acquire);
+
+		if (cursor == committed)
+		{
+			return false;
+		}
+
+		if (committed - cursor > capacity)
+		{
+			stats.overruns++;
+			skipToNewest();
+			continue;
+		}
+
+		uint64_t offset = cursor & (capacity - 1);
+		SharedRingEntry current;
+		memcpy(&current, &mapping.data()[offset], sizeof(current));
+
+		bool wrap = (current.flags & SHARED_RING_FLAG_WRAP) != 0;
+		uint64_t size = wrap ? current.length : alignEntry(sizeof(SharedRingEntry) + current.length);
+
+		if (size == 0 || offset + size > capacity)
+		{
+			// torn header, the writer is overwriting this part
+			stats.overruns++;
+			skipToNewest();
+			continue;
+		}
+
+		if (wrap == false)
+		{
+			entry.assign(&mapping.data()[offset + sizeof(current)], &mapping.data()[offset + sizeof(current) + current.length]);
+		}
+
+		// what was copied is only valid if the writer has not reserved it since
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (header->reserved.load(std::memory_order_relaxed) - cursor > capacity)
+		{
+			stats.overruns++;
+			skipToNewest();
+			continue;
+		}
+
+		cursor += size;
+
+		if (wrap)
+		{
+			continue;
+		}
+
+		if (synced && current.sequence > sequence)
+		{
+			stats.lost += current.sequence - sequence;
+		}
+
+		sequence = current.sequence + 1;
+		synced = true;
+		stats.entries++;
+		stats.bytes += current.length;
+
+		return true;
+	}
+}
+
+bool SharedRingReader::isWriterClosed()
+{
+	return mapping.header() == nullptr || mapping.header()->closed.load(std::memory_order_acquire) != 0;
+}
+
+SharedRingStats SharedRingReader::getStats()
+{
+	return stats;
+}
+
+void SharedRingReader::skipToNewest()
+{
+	// expected sequence is kept, the next entry read tells how many were lost
+	cursor = mapping.header()->committed.load(std::memory_order_acquire);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Named shared-memory ring with one writer process and any number of reader
+// processes. Readers keep their own cursor and never hold the writer back;
+// a reader that is lapped notices it and skips ahead, counting the records
+// it lost.
+//
+// Entries are 16-byte aligned: SharedRingEntry followed by the data. An
+// entry that would cross the end of the ring is preceded by a wrap marker
+// covering the rest of it. The writer announces the range it is about to
+// overwrite in `reserved` before touching it and publishes finished entries
+// in `committed`, so readers can tell whether what they copied is intact.
+//
+// This code does not depend on the driver: Windows uses a named file
+// mapping, other systems POSIX shared memory, so it can be tested anywhere.
+
+#define SHARED_RING_MAGIC        0x52425355 // "USBR"
+#define SHARED_RING_VERSION      1
+#define SHARED_RING_ALIGNMENT    16
+#define SHARED_RING_FLAG_WRAP    (1 << 0)
+
+#define DEFAULT_SHARED_RING_SIZE (16*1024*1024)
+
+struct SharedRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity; // data bytes, power of two
+
+	std::atomic<uint64_t> reserved;  // end of the range being written
+	std::atomic<uint64_t> committed; // end of the last complete entry
+	std::atomic<uint64_t> oldest;    // first entry not overwritten yet
+	std::atomic<uint32_t> closed;    // writer is gone
+
+	uint8_t padding[20];
+};
+
+struct SharedRingEntry
+{
+	uint32_t length;   // data bytes, for a wrap marker the bytes skipped
+	uint32_t flags;
+	uint64_t sequence;
+};
+
+struct SharedRingStats
+{
+	uint64_t entries;
+	uint64_t bytes;
+	uint64_t overruns; // times the reader was lapped
+	uint64_t lost;     // entries skipped because of overruns
+};
+
+class SharedRingMapping
+{
+public:
+	SharedRingMapping() = default;
+	~SharedRingMapping();
+
+	SharedRingMapping(const SharedRingMapping&) = delete;
+	SharedRingMapping& operator=(const SharedRingMapping&) = delete;
+
+public:
+	bool create(const std::string& name, size_t size);
+	bool open(const std::string& name);
+	void close();
+
+	SharedRingHeader* header() const
+	{
+		return (SharedRingHeader*)view;
+	}
+
+	uint8_t* data() const
+	{
+		return (uint8_t*)view + sizeof(SharedRingHeader);
+	}
+
+private:
+	void* view = nullptr;
+	size_t size = 0;
+
+	void* handle = nullptr; // HANDLE of the file mapping on Windows
+	std::string unlinkName; // POSIX object removed by the creator
+};
+
+class SharedRingWriter
+{
+public:
+	SharedRingWriter() = default;
+	~SharedRingWriter();
+
+	SharedRingWriter(const SharedRingWriter&) = delete;
+	SharedRingWriter& operator=(const SharedRingWriter&) = delete;
+
+public:
+	// capacity is rounded up to a power of two, fails when the name is taken
+	bool create(const std::string& name, size_t capacity = DEFAULT_SHARED_RING_SIZE);
+	void close();
+	bool isOpen();
+
+	// Entries larger than a quarter of the ring are rejected.
+	bool write(const void* data, uint32_t length);
+
+	SharedRingStats getStats();
+
+private:
+	SharedRingMapping mapping;
+	uint64_t position = 0;
+	uint64_t oldest = 0;
+	SharedRingStats stats = {};
+
+};
+
+class SharedRingReader
+{
+public:
+	SharedRingReader() = default;
+
+	SharedRingReader(const SharedRingReader&) = delete;
+	SharedRingReader& operator=(const SharedRingReader&) = delete;
+
+public:
+	// Starts after the newest entry, fromOldest replays what is still in the ring.
+	bool open(const std::string& name, bool fromOldest = false);
+	void close();
+
+	// Copies the next entry, returns false when there is none yet.
+	bool read(std::vector<uint8_t>& entry);
+	bool isWriterClosed();
+
+	SharedRingStats getStats();
+
+private:
+	void skipToNewest();
+
+private:
+	SharedRingMapping mapping;
+	uint64_t cursor = 0;
+	uint64_t sequence = 0; // expected sequence of the next entry
+	bool synced = false;   // sequence is known
+	SharedRingStats stats = {};
+
+};
@@ -0,0 +1,55 @@
+#include "SharedRingSink.h"
+
+SharedRingSink::~SharedRingSink()
+{
+	close();
+}
+
+bool SharedRingSink::create(const std::string& name, size_t capacity)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	rejected = 0;
+	return writer.create(name, capacity);
+}
+
+void SharedRingSink::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	writer.close();
+}
+
+void SharedRingSink::consume(const RecordBatch& batch)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (writer.isOpen() == false)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		const CaptureRecord& record = batch.records[i];
+
+		if (writer.write(&batch.buffer[record.offset], sizeof(pcaprec_hdr_t) + record.record.incl_len) == false)
+		{
+			rejected++;
+		}
+	}
+}
+
+SharedRingStats SharedRingSink::getStats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return writer.getStats();
+}
+
+UINT64 SharedRingSink::getRejected()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return rejected;
+}
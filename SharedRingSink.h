@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <mutex>
+#include <string>
+
+#include "RecordSink.h"
+#include "SharedRing.h"
+
+// Publishes every captured record to a named SharedRing so that other
+// processes can follow the capture of the one process owning the device.
+// Each entry is one pcap record header followed by the USBPcap packet,
+// decodeRecords() parses it as is.
+class SharedRingSink : public RecordSink
+{
+public:
+	SharedRingSink() = default;
+	~SharedRingSink();
+
+	SharedRingSink(const SharedRingSink&) = delete;
+	SharedRingSink& operator=(const SharedRingSink&) = delete;
+
+public:
+	bool create(const std::string& name, size_t capacity = DEFAULT_SHARED_RING_SIZE);
+	void close();
+
+	void consume(const RecordBatch& batch) override;
+
+	SharedRingStats getStats();
+	UINT64 getRejected();
+
+private:
+	std::mutex lock;
+	SharedRingWriter writer;
+	UINT64 rejected = 0; // records too large for the ring
+
+};
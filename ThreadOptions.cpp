@@ -0,0 +1,103 @@
+#include "ThreadOptions.h"
+
+#include <stdio.h>
+
+#include <mutex>
+
+// Kernel32 and avrt.dll functions are not available on every supported
+// Windows version, resolve them at runtime.
+typedef HRESULT(WINAPI* SETTHREADDESCRIPTION)(HANDLE, PCWSTR);
+typedef HANDLE(WINAPI* AVSETMMTHREADCHARACTERISTICSA)(LPCSTR, LPDWORD);
+typedef BOOL(WINAPI* AVSETMMTHREADPRIORITY)(HANDLE, int);
+typedef BOOL(WINAPI* AVREVERTMMTHREADCHARACTERISTICS)(HANDLE);
+
+static SETTHREADDESCRIPTION            SetThreadDescriptionFn;
+static AVSETMMTHREADCHARACTERISTICSA   AvSetMmThreadCharacteristicsFn;
+static AVSETMMTHREADPRIORITY           AvSetMmThreadPriorityFn;
+static AVREVERTMMTHREADCHARACTERISTICS AvRevertMmThreadCharacteristicsFn;
+
+static void init_thread_functions()
+{
+	static std::once_flag once;
+
+	std::call_once(once, []()
+	{
+		HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+		if (kernel32 != NULL)
+		{
+			SetThreadDescriptionFn = (SETTHREADDESCRIPTION)GetProcAddress(kernel32, "SetThreadDescription");
+		}
+
+		// kept loaded for the lifetime of the process
+		HMODULE avrt = LoadLibraryA("avrt.dll");
+		if (avrt != NULL)
+		{
+			AvSetMmThreadCharacteristicsFn = (AVSETMMTHREADCHARACTERISTICSA)GetProcAddress(avrt, "AvSetMmThreadCharacteristicsA");
+			AvSetMmThreadPriorityFn = (AVSETMMTHREADPRIORITY)GetProcAddress(avrt, "AvSetMmThreadPriority");
+			AvRevertMmThreadCharacteristicsFn = (AVREVERTMMTHREADCHARACTERISTICS)GetProcAddress(avrt, "AvRevertMmThreadCharacteristics");
+		}
+	});
+}
+
+HANDLE applyThreadOptions(const ThreadOptions& options)
+{
+	HANDLE thread = GetCurrentThread();
+	HANDLE mmcssHandle = NULL;
+
+	init_thread_functions();
+
+	if (options.name.empty() == false && SetThreadDescriptionFn != NULL)
+	{
+		std::wstring name(options.name.begin(), options.name.end());
+		SetThreadDescriptionFn(thread, name.c_str());
+	}
+
+	if (options.affinityMask != 0 && SetThreadAffinityMask(thread, options.affinityMask) == 0)
+	{
+		fprintf(stderr, "SetThreadAffinityMask failed with %d\n", GetLastError());
+	}
+
+	if (options.mmcssTask.empty() == false)
+	{
+		if (AvSetMmThreadCharacteristicsFn != NULL)
+		{
+			DWORD taskIndex = 0;
+
+			mmcssHandle = AvSetMmThreadCharacteristicsFn(options.mmcssTask.c_str(), &taskIndex);
+			if (mmcssHandle == NULL)
+			{
+				fprintf(stderr, "AvSetMmThreadCharacteristics(%s) failed with %d\n", options.mmcssTask.c_str(), GetLastError());
+			}
+			else if (AvSetMmThreadPriorityFn != NULL)
+			{
+				AvSetMmThreadPriorityFn(mmcssHandle, options.mmcssPriority);
+			}
+		}
+		else
+		{
+			fprintf(stderr, "MMCSS is not available\n");
+		}
+	}
+
+	// MMCSS manages the priority of registered threads itself
+	if (mmcssHandle == NULL && options.priority != THREAD_PRIORITY_NORMAL &&
+		SetThreadPriority(thread, options.priority) == FALSE)
+	{
+		fprintf(stderr, "SetThreadPriority failed with %d\n", GetLastError());
+	}
+
+	if (options.disablePriorityBoost)
+	{
+		SetThreadPriorityBoost(thread, TRUE);
+	}
+
+	return mmcssHandle;
+}
+
+void revertThreadOptions(HANDLE mmcssHandle)
+{
+	if (mmcssHandle != NULL && AvRevertMmThreadCharacteristicsFn != NULL)
+	{
+		AvRevertMmThreadCharacteristicsFn(mmcssHandle);
+	}
+}
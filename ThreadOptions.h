@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <string>
+
+// Scheduling options applied by a capture thread to itself.
+struct ThreadOptions
+{
+	std::string name;          // shown in debuggers, empty keeps the default
+
+	DWORD_PTR affinityMask = 0; // 0 keeps the process affinity
+	int priority = THREAD_PRIORITY_NORMAL;
+	bool disablePriorityBoost = false;
+
+	std::string mmcssTask;      // MMCSS task, e.g. "Capture" or "Pro Audio", empty to skip
+	int mmcssPriority = 0;      // AVRT_PRIORITY_* when mmcssTask is set
+};
+
+// Applies options to the calling thread. Returns MMCSS handle to be passed
+// to revertThreadOptions() before the thread exits (may be NULL).
+HANDLE applyThreadOptions(const ThreadOptions& options);
+void revertThreadOptions(HANDLE mmcssHandle);
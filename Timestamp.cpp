@@ -0,0 +1,36 @@
+#include "Timestamp.h"
+
+#include <chrono>
+
+MonotonicClock& MonotonicClock::instance()
+{
+	static MonotonicClock clock;
+	return clock;
+}
+
+uint64_t MonotonicClock::now()
+{
+	auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+ManualClock::ManualClock(uint64_t start)
+	: current(start)
+{
+}
+
+uint64_t ManualClock::now()
+{
+	return current.load();
+}
+
+void ManualClock::set(uint64_t ns)
+{
+	current.store(ns);
+}
+
+void ManualClock::advance(uint64_t ns)
+{
+	current.fetch_add(ns);
+}
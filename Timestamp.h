@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Common time type of the capture layer: 64-bit nanoseconds.
+// Record timestamps count from the Unix epoch, arrival times come from a
+// monotonic Clock and only make sense relative to each other.
+//
+// This header does not depend on Windows so timing code can be tested anywhere.
+
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+// 100 ns FILETIME intervals between 1601-01-01 and 1970-01-01
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL
+
+inline uint64_t pcapTimestampToNs(uint32_t sec, uint32_t usec)
+{
+	return (uint64_t)sec * NSEC_PER_SEC + (uint64_t)usec * NSEC_PER_USEC;
+}
+
+inline void nsToPcapTimestamp(uint64_t ns, uint32_t* sec, uint32_t* usec)
+{
+	*sec = (uint32_t)(ns / NSEC_PER_SEC);
+	*usec = (uint32_t)((ns % NSEC_PER_SEC) / NSEC_PER_USEC);
+}
+
+inline uint64_t fileTimeToNs(uint64_t fileTime)
+{
+	return (fileTime - FILETIME_UNIX_EPOCH) * 100;
+}
+
+class Clock
+{
+public:
+	virtual ~Clock() = default;
+
+public:
+	virtual uint64_t now() = 0;
+};
+
+// High-resolution monotonic clock (QueryPerformanceCounter on Windows).
+class MonotonicClock : public Clock
+{
+public:
+	static MonotonicClock& instance();
+
+public:
+	uint64_t now() override;
+};
+
+// Deterministic clock that only moves when told to.
+class ManualClock : public Clock
+{
+public:
+	explicit ManualClock(uint64_t start = 0);
+
+public:
+	uint64_t now() override;
+
+	void set(uint64_t ns);
+	void advance(uint64_t ns);
+
+private:
+	std::atomic<uint64_t> current;
+
+};
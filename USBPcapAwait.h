@@ -0,0 +1,91 @@
+#pragma once
+
+// C++20 coroutine front end of AwaitRegistry:
+//
+//   AwaitResult result = co_await awaitControl(helper.getAwaitRegistry(), device, 1000);
+//
+// The coroutine is resumed on the capture thread, or on the registry's
+// executor when one is set, so keep the code up to the next co_await short.
+// Compiled only where the toolset supports coroutines.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <utility>
+
+#include "AwaitRegistry.h"
+
+template <class Start>
+class AwaitOperation
+{
+public:
+	AwaitOperation(Start start)
+		: start(std::move(start))
+	{
+	}
+
+public:
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		// nothing of this awaiter is touched once the wait is registered
+		UINT64 id = start([this, handle](AwaitResult&& completed)
+		{
+			result = std::move(completed);
+			handle.resume();
+		});
+
+		if (id == 0)
+		{
+			result.status = AwaitStatus::Stopped;
+			return false;
+		}
+
+		return true;
+	}
+
+	AwaitResult await_resume()
+	{
+		return std::move(result);
+	}
+
+private:
+	Start start;
+	AwaitResult result = {};
+};
+
+template <class Start>
+inline AwaitOperation<Start> makeAwaitOperation(Start start)
+{
+	return AwaitOperation<Start>(std::move(start));
+}
+
+inline auto awaitRecord(AwaitRegistry& registry, RecordMatcher match, DWORD timeout = INFINITE)
+{
+	return makeAwaitOperation([&registry, match, timeout](AwaitCompletion completion)
+	{
+		return registry.awaitRecord(match, timeout, std::move(completion));
+	});
+}
+
+inline auto awaitBytes(AwaitRegistry& registry, USHORT device, UCHAR endpoint, size_t bytes, DWORD timeout = INFINITE)
+{
+	return makeAwaitOperation([&registry, device, endpoint, bytes, timeout](AwaitCompletion completion)
+	{
+		return registry.awaitBytes(device, endpoint, bytes, timeout, std::move(completion));
+	});
+}
+
+inline auto awaitControl(AwaitRegistry& registry, int device, DWORD timeout = INFINITE)
+{
+	return makeAwaitOperation([&registry, device, timeout](AwaitCompletion completion)
+	{
+		return registry.awaitControl(device, timeout, std::move(completion));
+	});
+}
+
+#endif
@@ -1,38 +1,46 @@
 #include "USBPcapHelper.h"
 
 #include <stdio.h>
+#include <algorithm>
 #include <thread>
 #include <functional>
 
 #include <initguid.h>
 #include <usbiodef.h>
 
+#include "CapturePipeline.h"
+#include "DescriptorCache.h"
+#include "DeviceResolver.h"
 #include "filters.h"
-#include "enum.h"
+#include "FilterRegistry.h"
 #include "iocontrol.h"
 
-struct FindDeviceContext
+USBPcapHelper::USBPcapHelper()
 {
-	USHORT idVendor;
-	USHORT idProduct;
-	UINT indexFound = 0;
-};
+	sessionOptions.reader.name = "USBPcap reader";
 
-struct DataHeader
-{
-	pcaprec_hdr_s recordHeader;
-	USBPCAP_BUFFER_PACKET_HEADER packetHeader;
-};
+	// new waiters may need an earlier wake-up than the reader is waiting for
+	awaitRegistry.setWakeup([this]()
+	{
+		if (session != nullptr)
+		{
+			session->wake();
+		}
+	});
+}
 
-USBPcapHelper::USBPcapHelper()
+USBPcapHelper::~USBPcapHelper()
 {
+	// subclasses should stop() first, their callbacks are gone by now
+	stop();
 }
 
-bool USBPcapHelper::findDevice(USHORT idVendor, USHORT idProduct)
+bool USBPcapHelper::findDevice(USHORT idVendor, USHORT idProduct, const std::string& serialNumber)
 {
-	filters_initialize();
+	FilterRegistry& registry = FilterRegistry::instance();
 
-	if (usbpcapFilters[0] == NULL)
+	// driver may have been started after the last discovery
+	if (registry.devices().empty() && registry.refresh() == false)
 	{
 		printf("No filter control devices are available.\n");
 
@@ -44,165 +52,700 @@ bool USBPcapHelper::findDevice(USHORT idVendor, USHORT idProduct)
 	}
 
 
-	FindDeviceContext device;
-	device.idVendor = idVendor;
-	device.idProduct = idProduct;
+	DeviceResolver resolver;
+	resolver.addSelector(idVendor, idProduct, serialNumber);
+
+	std::vector<DeviceMatch> matches = resolver.resolve();
+	if (matches.empty())
+	{
+		return false;
+	}
+
+	deviceAddr = matches.front().filter;
+	roothub = FilterRegistry::roothubNumber(deviceAddr);
+
+	target = resolver.getSelectors().front();
+	tracker.setTarget(idVendor, idProduct);
+	tracker.setAddress(matches.front().deviceAddress);
+
+	// unknown address, capture the whole root hub
+	deviceAddresses.clear();
+	if (matches.front().deviceAddress == 0 || deviceAddresses.add(matches.front().deviceAddress) == false)
+	{
+		deviceAddresses.setAll(true);
+	}
+
+	return true;
+}
+
+bool USBPcapHelper::start()
+{
+	broadcasting = broadcastRing.hasConsumers();
+
+	if (pullMode && broadcasting)
+	{
+		printf("Pull mode and broadcast consumers can't be used together\n");
+		return false;
+	}
+
+	session = CaptureSession::get(deviceAddr);
+
+	batchQueue.configure(&session->getBufferPool(), pullDepth);
+	broadcastRing.configure(&session->getBufferPool(), broadcastSlots, broadcastOverflow);
+
+	if (pullMode)
+	{
+		batchQueue.open();
+	}
+
+	if (broadcasting && broadcastRing.start() == false)
+	{
+		return false;
+	}
+
+	awaitRegistry.open();
+
+	if (changeOnly && deviceAddr.empty() == false)
+	{
+		enableChangeOnly(tracker.getAddress(), getDeviceConfiguration());
+	}
+
+	running = true;
+
+	DeviceAddressSet addresses = deviceAddresses;
+
+	// re-enumeration is only seen through the address 0 bit
+	retargetBit = autoRetarget && addresses.isAll() == false && addresses.contains(0) == false;
+	if (retargetBit)
+	{
+		addresses.add(0);
+	}
+
+	if (session->subscribe(this, addresses, sessionOptions) == false)
+	{
+		running = false;
+
+		batchQueue.close();
+		broadcastRing.close();
+		broadcastRing.join();
+		awaitRegistry.close();
+		return false;
+	}
+
+	return true;
+}
+
+void USBPcapHelper::stop()
+{
+	running = false;
+
+	batchQueue.close();
+	broadcastRing.close();
+	awaitRegistry.close();
+
+	// no more batches for this helper once it returns
+	if (session != nullptr)
+	{
+		// live changes carry over to the next start()
+		session->getAddresses(this, deviceAddresses);
+		removeRetargetBit(deviceAddresses);
+		session->unsubscribe(this);
+	}
+
+	broadcastRing.join();
+	joinConfirmation();
+}
+
+bool USBPcapHelper::isRunning()
+{
+	return running;
+}
+
+void USBPcapHelper::addSink(RecordSink* sink)
+{
+	std::lock_guard<std::mutex> guard(sinkLock);
 
-	auto findConnectedDevice = [](HANDLE hub, ULONG port, USHORT deviceAddress, PUSB_DEVICE_DESCRIPTOR desc, void *ctx)
+	if (std::find(sinks.begin(), sinks.end(), sink) == sinks.end())
 	{
-		auto device = reinterpret_cast<FindDeviceContext*>(ctx);
-		if (device == nullptr) return;
+		sinks.push_back(sink);
+	}
+}
+
+void USBPcapHelper::removeSink(RecordSink* sink)
+{
+	std::lock_guard<std::mutex> guard(sinkLock);
+
+	sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+}
 
-		if (desc->idVendor == device->idVendor &&
-			desc->idProduct == device->idProduct)
+void USBPcapHelper::setPullMode(bool enabled, size_t depth)
+{
+	pullMode = enabled;
+	pullDepth = depth;
+}
+
+const PulledBatch* USBPcapHelper::nextBatch(DWORD timeout)
+{
+	return batchQueue.pop(timeout);
+}
+
+void USBPcapHelper::releaseBatch(const PulledBatch* batch)
+{
+	batchQueue.release(const_cast<PulledBatch*>(batch));
+}
+
+BatchQueueStats USBPcapHelper::getPullStats()
+{
+	return batchQueue.getStats();
+}
+
+void USBPcapHelper::setBroadcastOptions(size_t slots, BroadcastOverflow overflow)
+{
+	broadcastSlots = slots;
+	broadcastOverflow = overflow;
+}
+
+size_t USBPcapHelper::addConsumer(BatchHandler handler, const ThreadOptions& options)
+{
+	return broadcastRing.addConsumer(std::move(handler), options);
+}
+
+BroadcastRing& USBPcapHelper::getBroadcastRing()
+{
+	return broadcastRing;
+}
+
+AwaitRegistry& USBPcapHelper::getAwaitRegistry()
+{
+	return awaitRegistry;
+}
+
+void USBPcapHelper::setReaderThreadOptions(const ThreadOptions& options)
+{
+	sessionOptions.reader = options;
+}
+
+void USBPcapHelper::setBufferFlags(unsigned int flags)
+{
+	sessionOptions.bufferFlags = flags;
+}
+
+void USBPcapHelper::setClock(Clock* clock)
+{
+	sessionOptions.clock = clock;
+
+	awaitRegistry.setClock(clock);
+}
+
+void USBPcapHelper::setRecordIndexEnabled(bool enabled)
+{
+	recordIndexEnabled = enabled;
+}
+
+void USBPcapHelper::setRecordFilter(const RecordPredicate& predicate)
+{
+	recordFilter.setPredicate(predicate);
+	recordFilterEnabled = true;
+}
+
+void USBPcapHelper::clearRecordFilter()
+{
+	recordFilterEnabled = false;
+}
+
+void USBPcapHelper::setIdentityMapEnabled(bool enabled)
+{
+	sessionOptions.identities = enabled;
+}
+
+BufferPoolStats USBPcapHelper::getBufferStats()
+{
+	if (session == nullptr)
+	{
+		return BufferPoolStats();
+	}
+
+	return session->getBufferPool().getStats();
+}
+
+ChangeDetector& USBPcapHelper::getChangeDetector()
+{
+	return changeDetector;
+}
+
+void USBPcapHelper::setChangeOnlyDelivery(bool enabled, UINT32 heartbeat)
+{
+	changeOnly = enabled;
+	changeHeartbeat = heartbeat;
+}
+
+LoadShedder& USBPcapHelper::getLoadShedder()
+{
+	return loadShedder;
+}
+
+bool USBPcapHelper::addDeviceAddress(USHORT address)
+{
+	// under the session lock, callbacks may retarget the helper as well
+	if (running && session != nullptr)
+	{
+		if (onBlockingConsumer())
 		{
-			device->indexFound = port;
+			printf("Device addresses can't be changed from a blocking broadcast consumer\n");
+			return false;
+		}
+
+		// already subscribed for retargeting, the caller owns it from now on
+		if (address == 0 && retargetBit.exchange(false))
+		{
+			return true;
 		}
-	};
 
-	int i = 0;
-	while (usbpcapFilters[i] != NULL)
+		return session->addAddress(this, address);
+	}
+
+	return deviceAddresses.add(address);
+}
+
+bool USBPcapHelper::removeDeviceAddress(USHORT address)
+{
+	if (running && session != nullptr)
 	{
-		enumerate_all_connected_devices(usbpcapFilters[i]->device, findConnectedDevice, &device);
+		if (onBlockingConsumer())
+		{
+			printf("Device addresses can't be changed from a blocking broadcast consumer\n");
+			return false;
+		}
 
-		if (device.indexFound > 0)
+		// not the caller's, auto-retarget still needs it
+		if (address == 0 && retargetBit)
 		{
-			deviceAddr = usbpcapFilters[i]->device;
-			return true;
+			return false;
 		}
 
-		i++;
+		return session->removeAddress(this, address);
 	}
 
-	return false;
+	return deviceAddresses.remove(address);
 }
 
-bool USBPcapHelper::start()
+bool USBPcapHelper::setDeviceAddresses(const DeviceAddressSet& addresses)
+{
+	if (running && session != nullptr)
+	{
+		if (onBlockingConsumer())
+		{
+			printf("Device addresses can't be changed from a blocking broadcast consumer\n");
+			return false;
+		}
+
+		DeviceAddressSet subscribed = addresses;
+		bool added = autoRetarget && subscribed.isAll() == false && subscribed.contains(0) == false;
+
+		if (added)
+		{
+			subscribed.add(0);
+		}
+
+		if (session->setAddresses(this, subscribed) == false)
+		{
+			return false;
+		}
+
+		retargetBit = added;
+		return true;
+	}
+
+	deviceAddresses = addresses;
+	return true;
+}
+
+DeviceAddressSet USBPcapHelper::getDeviceAddresses()
 {
-	USBPCAP_ADDRESS_FILTER filter;
-	DWORD bytes_ret = 0;
+	DeviceAddressSet addresses = deviceAddresses;
 
-	if (USBPcapInitAddressFilter(&filter, NULL, TRUE) == FALSE)
+	// a blocking consumer gets the addresses from before start()
+	if (running && session != nullptr && onBlockingConsumer() == false)
 	{
-		return false;
+		session->getAddresses(this, addresses);
+		removeRetargetBit(addresses);
+	}
+
+	return addresses;
+}
+
+void USBPcapHelper::removeRetargetBit(DeviceAddressSet& addresses)
+{
+	if (retargetBit)
+	{
+		addresses.remove(0);
 	}
+}
+
+// The reader waits for a blocking consumer while it holds the session lock,
+// that consumer waiting for the lock in turn would never return.
+bool USBPcapHelper::onBlockingConsumer()
+{
+	return broadcasting && broadcastOverflow == BroadcastOverflow::Block && broadcastRing.isConsumerThread();
+}
+
+void USBPcapHelper::setAutoRetarget(bool enabled)
+{
+	autoRetarget = enabled;
+}
 
-	deviceHandle = CreateFileA(deviceAddr, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, 0);
-	if (deviceHandle == INVALID_HANDLE_VALUE)
+DeviceTrackerStats USBPcapHelper::getTrackerStats()
+{
+	return tracker.getStats();
+}
+
+std::shared_ptr<const CachedConfiguration> USBPcapHelper::getDeviceConfiguration()
+{
+	if (deviceAddr.empty())
 	{
-		printf("Couldn't open device: %d\n", GetLastError());
-		return false;
+		return nullptr;
 	}
 
+	return DescriptorCache::instance().findConfiguration(roothub, tracker.getAddress());
+}
+
+void USBPcapHelper::onBatch(const RecordBatch& batch, CaptureBuffer* buffer)
+{
+	// own copy, shedding and pulled batches modify it
+	records.assign(batch.records, batch.records + batch.count);
+
+	if (autoRetarget)
+	{
+		trackDevice(batch);
+
+		DeviceAddressSet addresses;
+		session->getAddresses(this, addresses);
+
+		// other devices seen through the address 0 bit
+		records.erase(std::remove_if(records.begin(), records.end(),
+			[&addresses](const CaptureRecord& record) { return record.header.device == 0 || addresses.contains(record.header.device) == false; }), records.end());
+
+		if (records.empty())
+		{
+			return;
+		}
+	}
 
-	if (DeviceIoControl(deviceHandle, IOCTL_USBPCAP_SET_SNAPLEN_SIZE, &snaplen, sizeof(snaplen), NULL, 0, &bytes_ret, 0) == false)
+	// cheap column scan first, shedding then only weighs wanted records
+	if (recordFilterEnabled)
 	{
-		printf("DeviceIoControl failed with %d status (supplimentary code %d)\n", GetLastError(), bytes_ret);
-		goto FINISH;
+		RecordBatch unfiltered = batch;
+		unfiltered.records = records.data();
+		unfiltered.count = records.size();
+
+		recordIndex.build(unfiltered);
+
+		if (recordFilter.select(recordIndex, records, selection) == 0)
+		{
+			return;
+		}
 	}
 
-	if (DeviceIoControl(deviceHandle, IOCTL_USBPCAP_SETUP_BUFFER, &bufferlen, sizeof(bufferlen), NULL, 0, &bytes_ret, 0) == false)
+	// a full read buffer means the driver has more queued than we keep up with
+	if (loadShedder.isEnabled() && loadShedder.apply(records, batch.bytes, session->getBufferSize()) == 0)
 	{
-		printf("DeviceIoControl failed with %d status (supplimentary code %d)\n", GetLastError(), bytes_ret);
-		goto FINISH;
+		return;
 	}
 
-	if (DeviceIoControl(deviceHandle, IOCTL_USBPCAP_START_FILTERING, &filter, sizeof(filter), NULL, 0, &bytes_ret, 0) == false)
+	RecordBatch filtered = batch;
+	filtered.records = records.data();
+	filtered.count = records.size();
+	filtered.index = nullptr;
+
+	if (recordIndexEnabled)
 	{
-		printf("DeviceIoControl failed with %d status (supplimentary code %d)\n", GetLastError(), bytes_ret);
-		goto FINISH;
+		recordIndex.build(filtered);
+		filtered.index = &recordIndex;
 	}
 
+	{
+		std::lock_guard<std::mutex> guard(sinkLock);
 
-	running = true;
+		for (auto sink : sinks)
+		{
+			sink->consume(filtered);
+		}
+	}
 
-	std::thread(std::bind(&USBPcapHelper::readDataFromDevice, this)).detach();
-	return true;
+	awaitRegistry.dispatch(filtered);
 
-FINISH:
-	if (deviceHandle != INVALID_HANDLE_VALUE)
+	processBatch(filtered);
+
+	// pulled and broadcast batches keep the read buffer alive
+	if (pullMode)
+	{
+		batchQueue.push(buffer, batch.bytes, records);
+	}
+	else if (broadcasting)
 	{
-		CloseHandle(deviceHandle);
+		broadcastRing.publish(buffer, batch.bytes, records);
 	}
+}
 
-	return false;
+DWORD USBPcapHelper::getTimeout()
+{
+	return awaitRegistry.nextTimeout();
 }
 
-void USBPcapHelper::stop()
+void USBPcapHelper::onTimer()
+{
+	awaitRegistry.expire();
+
+	if (autoRetarget)
+	{
+		applyConfirmation();
+	}
+}
+
+void USBPcapHelper::onStopped()
 {
+	session->getAddresses(this, deviceAddresses);
+	removeRetargetBit(deviceAddresses);
+
 	running = false;
+
+	batchQueue.close();
+	broadcastRing.close();
+	awaitRegistry.close();
 }
 
-bool USBPcapHelper::isRunning()
+void USBPcapHelper::trackDevice(const RecordBatch& batch)
 {
-	return running;
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		USHORT candidate;
+
+		if (tracker.observe(batch.buffer, batch.records[i], candidate) == false)
+		{
+			continue;
+		}
+
+		confirmTarget(candidate, batch.records[i].timestamp);
+	}
 }
 
-void USBPcapHelper::readDataFromDevice()
+void USBPcapHelper::confirmTarget(USHORT candidate, UINT64 timestamp)
 {
-	OVERLAPPED readOverlapped;
-	HANDLE readHandle;
+	{
+		std::lock_guard<std::mutex> guard(confirmLock);
+
+		// drivers read the descriptor again, the walk in progress answers for it
+		if (confirming)
+		{
+			return;
+		}
+	}
 
-	unsigned char* buffer = new unsigned char[bufferlen];
-	memset(buffer, 0, bufferlen);
+	// the previous walk was applied already
+	joinConfirmation();
 
-	memset(&readOverlapped, 0, sizeof(readOverlapped));
-	readOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-	readHandle = readOverlapped.hEvent;
+	{
+		std::lock_guard<std::mutex> guard(confirmLock);
+
+		confirming = true;
+		currentAddress = tracker.getAddress();
+		candidateAddress = candidate;
+		candidateTimestamp = timestamp;
+	}
+
+	confirmer = std::thread(&USBPcapHelper::resolveTarget, this);
+}
 
-	ReadFile(deviceHandle, buffer, bufferlen, NULL, &readOverlapped);
+void USBPcapHelper::resolveTarget()
+{
+	USHORT current;
+	USHORT candidate;
 
-	while (running)
 	{
-		DWORD dw = WaitForSingleObject(readHandle, INFINITE);
-		DWORD read;
+		std::lock_guard<std::mutex> guard(confirmLock);
+
+		current = currentAddress;
+		candidate = candidateAddress;
+	}
+
+	// serial number isn't in the captured traffic, ask the hub; re-enumeration is rare enough
+	DeviceResolver resolver;
+	resolver.addSelector(target.idVendor, target.idProduct, target.serialNumber);
+
+	bool currentFound = false;
+	bool candidateFound = false;
+	USHORT first = 0;
 
-		if (dw == WAIT_OBJECT_0)
+	for (auto& match : resolver.resolve())
+	{
+		if (match.filter != deviceAddr)
 		{
-			GetOverlappedResult(deviceHandle, &readOverlapped, &read, TRUE);
-			ResetEvent(readOverlapped.hEvent);
+			continue;
+		}
 
-			processRawData(buffer, read);
+		currentFound |= (match.deviceAddress == current);
+		candidateFound |= (match.deviceAddress == candidate);
 
-			ReadFile(deviceHandle, buffer, bufferlen, &read, &readOverlapped);
+		if (first == 0)
+		{
+			first = match.deviceAddress;
 		}
-		else if (dw == WAIT_FAILED)
+	}
+
+	// the original device is still attached, the candidate is another one of the same kind
+	USHORT address = 0;
+
+	if (currentFound)
+	{
+		address = current;
+	}
+	else if (candidateFound)
+	{
+		address = candidate;
+	}
+	else if (target.serialNumber.empty() == false)
+	{
+		// only the target has this serial number
+		address = first;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(confirmLock);
+
+		resolvedAddress = address;
+		confirmed = true;
+	}
+
+	// result is applied from onTimer() on the reader thread
+	if (session != nullptr)
+	{
+		session->wake();
+	}
+}
+
+void USBPcapHelper::applyConfirmation()
+{
+	USHORT candidate;
+	USHORT address;
+	UINT64 timestamp;
+
+	{
+		std::lock_guard<std::mutex> guard(confirmLock);
+
+		if (confirmed == false)
 		{
-			fprintf(stderr, "WaitForMultipleObjects failed in read_thread(): %d", GetLastError());
-			break;
+			return;
 		}
+
+		candidate = candidateAddress;
+		address = resolvedAddress;
+		timestamp = candidateTimestamp;
+
+		confirmed = false;
+		confirming = false;
+	}
+
+	if (address != candidate)
+	{
+		tracker.reject(candidate, timestamp);
+	}
+
+	if (address != 0 && address != tracker.getAddress())
+	{
+		moveTarget(address);
+	}
+}
+
+void USBPcapHelper::moveTarget(USHORT address)
+{
+	USHORT previous = tracker.getAddress();
+	// the confirmed device is the same one, so is its configuration
+	std::shared_ptr<const CachedConfiguration> configuration = getDeviceConfiguration();
+
+	DeviceAddressSet addresses;
+	session->getAddresses(this, addresses);
+
+	// the old address may be handed to another device next
+	addresses.remove(previous);
+	addresses.add(address);
+
+	if (session->setAddresses(this, addresses) == false)
+	{
+		printf("Couldn't move capture to device address %d\n", address);
 	}
 
-	CancelIo(deviceHandle);
-	CloseHandle(deviceHandle);
-	CloseHandle(readOverlapped.hEvent);
+	tracker.retarget(address);
+
+	// both addresses belong to other connections now
+	DescriptorCache::instance().invalidate(roothub, previous);
+	DescriptorCache::instance().invalidate(roothub, address);
+
+	// payloads of the previous enumeration tell nothing about the new one
+	changeDetector.reset(previous);
+	changeDetector.reset(address);
 
-	if (buffer != NULL)
+	if (changeOnly)
 	{
-		delete[] buffer;
+		changeDetector.disable(previous);
+		enableChangeOnly(address, configuration);
 	}
+
+	onRetarget(previous, address);
 }
 
-void USBPcapHelper::processRawData(unsigned char* buffer, DWORD bytes)
+void USBPcapHelper::enableChangeOnly(USHORT address, const std::shared_ptr<const CachedConfiguration>& configuration)
 {
-	// beginning with a USBPcap header
-	if (bytes == sizeof(pcap_hdr_s))
+	if (configuration != nullptr)
 	{
-		// TODO: version handling
+		changeDetector.enable(address, configuration->getParsed(), changeHeartbeat);
 		return;
 	}
 
-	DataHeader header;
-	memcpy(&header, buffer, sizeof(header));
+	// descriptor not read, every interrupt endpoint of the device
+	changeDetector.enable(address, -1, changeHeartbeat);
+}
 
-	buffer += sizeof(header);
-	bytes -= sizeof(header);
+void USBPcapHelper::joinConfirmation()
+{
+	if (confirmer.joinable())
+	{
+		confirmer.join();
+	}
+
+	std::lock_guard<std::mutex> guard(confirmLock);
+
+	confirming = false;
+	confirmed = false;
+}
 
-	if (header.packetHeader.function != URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER ||
-		header.packetHeader.dataLength == 0)
+void USBPcapHelper::onRetarget(USHORT previous, USHORT address)
+{
+}
+
+void USBPcapHelper::processBatch(const RecordBatch& batch)
+{
+	// per-record adapter for subclasses only overriding processInterruptData()
+	struct InterruptDataSink
 	{
+		void deliver(const unsigned char* buffer, const CaptureRecord& record)
+		{
+			helper->processInterruptData(const_cast<unsigned char*>(buffer) + record.payloadOffset, record.payloadLength);
+		}
+
+		USBPcapHelper* helper;
+	};
+
+	if (changeDetector.isEnabled())
+	{
+		CapturePipeline<BulkOrInterruptFilter, ChangeOnlySink<InterruptDataSink>> pipeline(BulkOrInterruptFilter(), { &changeDetector, InterruptDataSink{ this } });
+		pipeline.process(batch);
 		return;
 	}
 
-	processInterruptData(buffer, header.packetHeader.dataLength);
+	CapturePipeline<BulkOrInterruptFilter, InterruptDataSink> pipeline(BulkOrInterruptFilter(), InterruptDataSink{ this });
+	pipeline.process(batch);
+}
+
+void USBPcapHelper::processInterruptData(unsigned char* buffer, DWORD bytes)
+{
 }
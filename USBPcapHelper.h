@@ -2,33 +2,175 @@
 
 #include <Windows.h>
 
-#define DEFAULT_SNAPSHOT_LENGTH             (65535)
-#define DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE (1024*1024)
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
-class USBPcapHelper
+#include "AwaitRegistry.h"
+#include "BatchQueue.h"
+#include "BroadcastRing.h"
+#include "BufferPool.h"
+#include "CaptureRecord.h"
+#include "CaptureSession.h"
+#include "ChangeDetector.h"
+#include "DeviceResolver.h"
+#include "DeviceTracker.h"
+#include "LoadShedder.h"
+#include "RecordFilter.h"
+#include "RecordIndex.h"
+#include "RecordSink.h"
+#include "ThreadOptions.h"
+#include "Timestamp.h"
+
+// Captures devices of one root hub, by default the one found by findDevice().
+// Helpers on the same root hub share a CaptureSession, each receives the
+// records of its own device addresses.
+class USBPcapHelper : public CaptureSubscriber
 {
 public:
 	USBPcapHelper();
-	virtual ~USBPcapHelper() = default;
+	virtual ~USBPcapHelper();
 
 public:
-	bool findDevice(USHORT idVendor, USHORT idProduct);
+	bool findDevice(USHORT idVendor, USHORT idProduct, const std::string& serialNumber = std::string());
 	bool start();
 	void stop();
 	bool isRunning();
 
+	void addSink(RecordSink* sink);
+	void removeSink(RecordSink* sink);
+
+	// Pull consumption, enable before start(). Pulled batches must be released,
+	// at the latest before the helper is destroyed.
+	void setPullMode(bool enabled, size_t depth = DEFAULT_PULL_QUEUE_DEPTH);
+	const PulledBatch* nextBatch(DWORD timeout = INFINITE);
+	void releaseBatch(const PulledBatch* batch);
+	BatchQueueStats getPullStats();
+
+	// Fan-out to consumer threads, set up before start(). Excludes pull mode.
+	// With BroadcastOverflow::Block consumers can't change the device addresses,
+	// the reader waits for them while dispatching.
+	void setBroadcastOptions(size_t slots, BroadcastOverflow overflow);
+	size_t addConsumer(BatchHandler handler, const ThreadOptions& options = ThreadOptions());
+	BroadcastRing& getBroadcastRing();
+
+	// One-shot waits on traffic, see USBPcapAwait.h for the coroutine interface.
+	AwaitRegistry& getAwaitRegistry();
+
+	void setReaderThreadOptions(const ThreadOptions& options);
+	void setBufferFlags(unsigned int flags);
+	void setClock(Clock* clock);
+	void setRecordIndexEnabled(bool enabled);
+	// Only records matching the predicate reach sinks and callbacks, set before start().
+	void setRecordFilter(const RecordPredicate& predicate);
+	void clearRecordFilter();
+	// Keeps DeviceIdentityMap::instance() current for the root hub, enable before start().
+	void setIdentityMapEnabled(bool enabled);
+	BufferPoolStats getBufferStats();
+
+	// Change-only delivery to processInterruptData(), configure before start().
+	ChangeDetector& getChangeDetector();
+	// Enables the change detector for the interrupt IN endpoints of the device
+	// found by findDevice() at start(), following it when it is retargeted.
+	void setChangeOnlyDelivery(bool enabled, UINT32 heartbeat = 0);
+	// Shedding before sinks and callbacks when the reader falls behind, configure before start().
+	LoadShedder& getLoadShedder();
+
+	// Captured addresses, changeable while running without reopening the device.
+	bool addDeviceAddress(USHORT address);
+	bool removeDeviceAddress(USHORT address);
+	bool setDeviceAddresses(const DeviceAddressSet& addresses);
+	DeviceAddressSet getDeviceAddresses();
+
+	// Follows the device found by findDevice() to its new address when it
+	// re-enumerates on the same root hub, enable before start(). Also captures
+	// newly connected devices (address 0 bit) to see the re-enumeration.
+	// The capture moves once a bus walk shows the old address is gone.
+	void setAutoRetarget(bool enabled);
+	DeviceTrackerStats getTrackerStats();
+
+	// Configuration descriptor of the device found by findDevice(), at its
+	// current address; nullptr when it wasn't read or the device re-enumerated since.
+	std::shared_ptr<const CachedConfiguration> getDeviceConfiguration();
+
 protected:
-	void readDataFromDevice();
-	void processRawData(unsigned char* buffer, DWORD bytes);
-	virtual void processInterruptData(unsigned char* buffer, DWORD bytes) = 0;
+	void onBatch(const RecordBatch& batch, CaptureBuffer* buffer) override;
+	DWORD getTimeout() override;
+	void onTimer() override;
+	void onStopped() override;
+
+	void trackDevice(const RecordBatch& batch);
+	void confirmTarget(USHORT candidate, UINT64 timestamp);
+	void resolveTarget();
+	void applyConfirmation();
+	void moveTarget(USHORT address);
+	void joinConfirmation();
+	bool onBlockingConsumer();
+	void removeRetargetBit(DeviceAddressSet& addresses);
+	void enableChangeOnly(USHORT address, const std::shared_ptr<const CachedConfiguration>& configuration);
+
+	// called on the reader thread after the capture moved to the new address
+	virtual void onRetarget(USHORT previous, USHORT address);
+	virtual void processBatch(const RecordBatch& batch);
+	virtual void processInterruptData(unsigned char* buffer, DWORD bytes);
 
 private:
-	unsigned int snaplen = DEFAULT_SNAPSHOT_LENGTH;
-	unsigned int bufferlen = DEFAULT_INTERNAL_KERNEL_BUFFER_SIZE;
+	std::string deviceAddr;
+	USHORT roothub = 0;
+
+	// subscribed with start(), the session owns the live copy while running
+	DeviceAddressSet deviceAddresses;
+
+	DeviceSelector target;
+	DeviceTracker tracker;
+	bool autoRetarget = false;
+	std::atomic<bool> retargetBit{ false }; // address 0 subscribed by auto-retarget, not by the caller
+
+	// candidates are checked with a bus walk off the reader thread, one at a time
+	std::thread confirmer;
+	std::mutex confirmLock;
+	bool confirming = false;
+	bool confirmed = false; // result is ready for the reader
+	USHORT currentAddress = 0; // tracked address when the walk started
+	USHORT candidateAddress = 0;
+	UINT64 candidateTimestamp = 0;
+	USHORT resolvedAddress = 0; // target's address found by the walk, 0 when not there
+
+	std::atomic<bool> running{ false };
+	CaptureSessionOptions sessionOptions;
+
+	// kept after stop(), pulled and broadcast batches live in its buffers
+	std::shared_ptr<CaptureSession> session;
+
+	BatchQueue batchQueue;
+	size_t pullDepth = DEFAULT_PULL_QUEUE_DEPTH;
+	bool pullMode = false;
+
+	BroadcastRing broadcastRing;
+	size_t broadcastSlots = DEFAULT_BROADCAST_SLOTS;
+	BroadcastOverflow broadcastOverflow = BroadcastOverflow::Drop;
+	bool broadcasting = false;
+
+	AwaitRegistry awaitRegistry;
+
+	std::mutex sinkLock;
+	std::vector<RecordSink*> sinks;
+
+	std::vector<CaptureRecord> records;
+	RecordIndex recordIndex;
+	bool recordIndexEnabled = false;
+
+	RecordFilter recordFilter;
+	bool recordFilterEnabled = false;
+	std::vector<UINT64> selection;
 
-	char* deviceAddr = nullptr;
-	HANDLE deviceHandle;
+	ChangeDetector changeDetector;
+	bool changeOnly = false;
+	UINT32 changeHeartbeat = 0;
 
-	bool running = false;
+	LoadShedder loadShedder;
 
 };
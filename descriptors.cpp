@@ -10,27 +10,35 @@
 #include <Windows.h>
 #include <devioctl.h>
 #include <Usbioctl.h>
+#include "descriptors.h"
+#include "DescriptorCache.h"
 #include "enum.h"
 #include "iocontrol.h"
+#include "Timestamp.h"
 #include "USBPcap.h"
 
 #define URB_SELECT_CONFIGURATION       0x0000
 #define URB_CONTROL_TRANSFER           0x0008
 #define URB_GET_DESCRIPTOR_FROM_DEVICE 0x000b
 
-typedef struct _list_entry
+#define PCAP_ARENA_INITIAL_SIZE 4096
+
+/* Growable buffer holding the resulting pcap records back to back */
+typedef struct _pcap_arena
 {
-    void *data; /* Packet data without pcaprec_hdr_t */
-    int length; /* data length in bytes */
-    struct _list_entry *next;
-} list_entry;
+    UINT8 *data;
+    int length;   /* bytes used */
+    int capacity; /* bytes allocated */
+    BOOL failed;  /* set when the buffer could not grow */
+    UINT32 ts_sec;  /* timestamp shared by all records */
+    UINT32 ts_usec;
+} pcap_arena;
 
 typedef struct _descriptor_callback_context
 {
     USHORT roothub;
     PUSBPCAP_ADDRESS_FILTER addresses;
-    list_entry *head;
-    list_entry *tail;
+    pcap_arena arena;
 } descriptor_callback_context;
 
 /* Get ddescriptor for given device
@@ -42,7 +50,7 @@ typedef struct _descriptor_callback_context
  * Returns dynamically allocated USB_DESCRIPTOR_REQUEST structure that must be freed
  * using free(). On failure, returns NULL.
  */
-static PUSB_DESCRIPTOR_REQUEST get_config_descriptor(HANDLE hub, ULONG port, UCHAR index)
+PUSB_DESCRIPTOR_REQUEST descriptors_get_config_descriptor(HANDLE hub, ULONG port, UCHAR index)
 {
     ULONG nBytes = 0;
     ULONG nBytesReturned = 0;
@@ -150,40 +158,69 @@ static void initialize_control_header(PUSBPCAP_BUFFER_CONTROL_HEADER hdr,
     hdr->stage = stage;
 }
 
-static void add_to_list(descriptor_callback_context *ctx, void *data, int length)
+static void arena_init(pcap_arena *arena)
 {
-    list_entry *new_tail = (list_entry*)malloc(sizeof(list_entry));
-    new_tail->data = data;
-    new_tail->length = length;
-    new_tail->next = NULL;
-    if (ctx->tail)
-    {
-        ctx->tail->next = new_tail;
-        ctx->tail = new_tail;
-    }
-    else
-    {
-        ctx->head = ctx->tail = new_tail;
-    }
+    FILETIME ts;
+    ULARGE_INTEGER timestamp;
+
+    arena->data = (UINT8*)malloc(PCAP_ARENA_INITIAL_SIZE);
+    arena->length = 0;
+    arena->capacity = (arena->data != NULL) ? PCAP_ARENA_INITIAL_SIZE : 0;
+    arena->failed = (arena->data != NULL) ? FALSE : TRUE;
+
+    /* All records describe the same moment, query the clock only once */
+    GetSystemTimeAsFileTime(&ts);
+    timestamp.LowPart = ts.dwLowDateTime;
+    timestamp.HighPart = ts.dwHighDateTime;
+
+    nsToPcapTimestamp(fileTimeToNs(timestamp.QuadPart), &arena->ts_sec, &arena->ts_usec);
 }
 
-static void free_list(list_entry *head)
+/* Appends pcap record header for data_len bytes of packet data.
+ *
+ * Returns pointer to data_len bytes where the packet data must be written.
+ * The pointer is valid until next call. On failure, returns NULL.
+ */
+static UINT8 *arena_append_record(pcap_arena *arena, int data_len)
 {
-    list_entry *e;
+    int needed = (int)sizeof(pcaprec_hdr_t) + data_len;
+    pcaprec_hdr_t *hdr;
 
-    if (!head)
+    if (arena->failed)
     {
-        return;
+        return NULL;
     }
 
-    e = head;
-    while (e)
+    if (arena->length + needed > arena->capacity)
     {
-        list_entry *tmp = e;
-        e = e->next;
-        free(tmp->data);
-        free(tmp);
+        int capacity = arena->capacity;
+        UINT8 *data;
+
+        while (arena->length + needed > capacity)
+        {
+            capacity *= 2;
+        }
+
+        data = (UINT8*)realloc(arena->data, capacity);
+        if (!data)
+        {
+            fprintf(stderr, "Failed to grow descriptors pcap buffer to %d bytes\n", capacity);
+            arena->failed = TRUE;
+            return NULL;
+        }
+
+        arena->data = data;
+        arena->capacity = capacity;
     }
+
+    hdr = (pcaprec_hdr_t*)&arena->data[arena->length];
+    hdr->ts_sec = arena->ts_sec;
+    hdr->ts_usec = arena->ts_usec;
+    hdr->incl_len = data_len;
+    hdr->orig_len = data_len;
+
+    arena->length += needed;
+    return (UINT8*)&hdr[1];
 }
 
 static void write_setup_packet(descriptor_callback_context *ctx,
@@ -197,9 +234,15 @@ static void write_setup_packet(descriptor_callback_context *ctx,
                                BOOL out)
 {
     int data_len = sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + 8;
-    UINT8 *data = (UINT8*)malloc(data_len);
+    UINT8 *data = arena_append_record(&ctx->arena, data_len);
     PUSBPCAP_BUFFER_CONTROL_HEADER hdr = (PUSBPCAP_BUFFER_CONTROL_HEADER)data;
-    UINT8 *setup = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
+    UINT8 *setup;
+
+    if (!data)
+    {
+        return;
+    }
+    setup = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
 
     initialize_control_header(hdr, ctx->roothub, deviceAddress, 8,
                               USBPCAP_CONTROL_STAGE_SETUP, function, FALSE, out);
@@ -212,8 +255,6 @@ static void write_setup_packet(descriptor_callback_context *ctx,
     setup[5] = (wIndex & 0xFF00) >> 8;
     setup[6] = (wLength & 0x00FF);
     setup[7] = (wLength & 0xFF00) >> 8;
-
-    add_to_list(ctx, data, data_len);
 }
 
 static void write_complete_packet(descriptor_callback_context *ctx,
@@ -224,17 +265,20 @@ static void write_complete_packet(descriptor_callback_context *ctx,
                                   BOOL out)
 {
     int data_len = sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + payload_length;
-    UINT8 *data = (UINT8*)malloc(data_len);
+    UINT8 *data = arena_append_record(&ctx->arena, data_len);
     PUSBPCAP_BUFFER_CONTROL_HEADER hdr = (PUSBPCAP_BUFFER_CONTROL_HEADER)data;
 
+    if (!data)
+    {
+        return;
+    }
+
     initialize_control_header(hdr, ctx->roothub, deviceAddress, payload_length,
                               USBPCAP_CONTROL_STAGE_COMPLETE, function, TRUE, out);
     if (payload_length > 0)
     {
         memcpy(&data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)], payload, payload_length);
     }
-
-    add_to_list(ctx, data, data_len);
 }
 
 static void
@@ -243,9 +287,15 @@ write_device_descriptor_complete(descriptor_callback_context *ctx,
                                  PUSB_DEVICE_DESCRIPTOR descriptor)
 {
     int data_len = sizeof(USBPCAP_BUFFER_CONTROL_HEADER) + 18;
-    UINT8 *data = (UINT8*)malloc(data_len);
+    UINT8 *data = arena_append_record(&ctx->arena, data_len);
     PUSBPCAP_BUFFER_CONTROL_HEADER hdr = (PUSBPCAP_BUFFER_CONTROL_HEADER)data;
-    UINT8 *payload = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
+    UINT8 *payload;
+
+    if (!data)
+    {
+        return;
+    }
+    payload = &data[sizeof(USBPCAP_BUFFER_CONTROL_HEADER)];
 
     initialize_control_header(hdr, ctx->roothub, deviceAddress, 18,
                               USBPCAP_CONTROL_STAGE_COMPLETE,
@@ -269,8 +319,6 @@ write_device_descriptor_complete(descriptor_callback_context *ctx,
     payload[15] = descriptor->iProduct;
     payload[16] = descriptor->iSerialNumber;
     payload[17] = descriptor->bNumConfigurations;
-
-    add_to_list(ctx, data, data_len);
 }
 
 static void
@@ -278,6 +326,7 @@ descriptor_callback(HANDLE hub, ULONG port, USHORT deviceAddress,
                     PUSB_DEVICE_DESCRIPTOR desc, void *context)
 {
     descriptor_callback_context *ctx = (descriptor_callback_context *)context;
+    std::shared_ptr<const CachedConfiguration> cached;
     PUSB_DESCRIPTOR_REQUEST request;
 
     if (!USBPcapIsDeviceFiltered(ctx->addresses, deviceAddress))
@@ -290,7 +339,9 @@ descriptor_callback(HANDLE hub, ULONG port, USHORT deviceAddress,
                        USB_DEVICE_DESCRIPTOR_TYPE << 8, 0, 18, FALSE);
     write_device_descriptor_complete(ctx, deviceAddress, desc);
 
-    request = get_config_descriptor(hub, port, 0);
+    cached = DescriptorCache::instance().getConfiguration(hub, port, ctx->roothub,
+                                                          deviceAddress, desc);
+    request = cached ? cached->getRequest() : NULL;
     if (request)
     {
         PUSB_CONFIGURATION_DESCRIPTOR config;
@@ -314,54 +365,10 @@ descriptor_callback(HANDLE hub, ULONG port, USHORT deviceAddress,
         write_complete_packet(ctx, URB_SELECT_CONFIGURATION, deviceAddress,
                               NULL, 0, TRUE);
     }
-    free(request);
-}
-
-void *generate_pcap_packets(list_entry *head, int *out_len)
-{
-    int total_length = 0;
-    list_entry *e;
-    UINT8 *pcap;
-    int offset;
-
-    for (e = head; e; e = e->next)
-    {
-        total_length += sizeof(pcaprec_hdr_t);
-        total_length += e->length;
-    }
-
-    *out_len = total_length;
-    pcap = (UINT8*)malloc(total_length);
-    offset = 0;
-    for (e = head; e; e = e->next)
-    {
-        FILETIME ts;
-        ULARGE_INTEGER timestamp;
-        pcaprec_hdr_t hdr;
-
-        GetSystemTimeAsFileTime(&ts);
-        timestamp.LowPart = ts.dwLowDateTime;
-        timestamp.HighPart = ts.dwHighDateTime;
-
-        hdr.ts_sec = (UINT32)(timestamp.QuadPart/10000000-11644473600);
-        hdr.ts_usec = (UINT32)((timestamp.QuadPart%10000000)/10);
-        hdr.incl_len = e->length;
-        hdr.orig_len = e->length;
-
-        memcpy(&pcap[offset], &hdr, sizeof(pcaprec_hdr_t));
-        offset += sizeof(pcaprec_hdr_t);
-
-        memcpy(&pcap[offset], e->data, e->length);
-        offset += e->length;
-    }
-
-    return pcap;
 }
 
 void *descriptors_generate_pcap(const char *filter, int *pcap_length, PUSBPCAP_ADDRESS_FILTER addresses)
 {
-    void *pcap_packets;
-    int pcap_packets_length;
     descriptor_callback_context ctx;
     const char *tmp;
     for (tmp = filter; *tmp; ++tmp) { /* Nothing to do here */ }
@@ -380,14 +387,18 @@ void *descriptors_generate_pcap(const char *filter, int *pcap_length, PUSBPCAP_A
     }
     ctx.roothub = (USHORT)atoi(tmp);
     ctx.addresses = addresses;
-    ctx.head = NULL;
-    ctx.tail = NULL;
+    arena_init(&ctx.arena);
     enumerate_all_connected_devices(filter, descriptor_callback, &ctx);
 
-    pcap_packets = generate_pcap_packets(ctx.head, &pcap_packets_length);
-    free_list(ctx.head);
-    *pcap_length = pcap_packets_length;
-    return pcap_packets;
+    if (ctx.arena.failed)
+    {
+        free(ctx.arena.data);
+        *pcap_length = 0;
+        return NULL;
+    }
+
+    *pcap_length = ctx.arena.length;
+    return ctx.arena.data;
 }
 
 void descriptors_free_pcap(void *pcap)
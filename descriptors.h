@@ -7,8 +7,12 @@
 #ifndef USBPCAP_DESCRIPTORS_H
 #define USBPCAP_DESCRIPTORS_H
 
+#include <Windows.h>
+#include <Usbioctl.h>
 #include "iocontrol.h"
 
+PUSB_DESCRIPTOR_REQUEST descriptors_get_config_descriptor(HANDLE hub, ULONG port, UCHAR index);
+
 void *descriptors_generate_pcap(const char *filter, int *pcap_length, PUSBPCAP_ADDRESS_FILTER addresses);
 void descriptors_free_pcap(void *pcap);
 
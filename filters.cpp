@@ -98,6 +98,14 @@ static void __cdecl unload_undocumented(void)
  */
 static BOOL init_undocumented()
 {
+	if (ntdll_handle != NULL)
+	{
+		/* Already loaded, atexit() handler is registered too */
+		return (NtQueryDirectoryObject != NULL &&
+				NtOpenDirectoryObject != NULL &&
+				NtClose != NULL) ? TRUE : FALSE;
+	}
+
 	ntdll_handle = LoadLibrary(_T("ntdll.dll"));
 
 	if (ntdll_handle == NULL)
@@ -195,6 +203,7 @@ static BOOL find_usbpcap_filters(struct list *list,
 	if (status != 0)
 	{
 		fprintf(stderr, "NtQueryDirectoryObject() failed\n");
+		NtClose(handle);
 		HeapFree(GetProcessHeap(), 0, info);
 		return FALSE;
 	}
@@ -296,8 +305,17 @@ void filters_initialize()
 	list.tail = NULL;
 	list.count = 0;
 
-	init_undocumented();
-	find_usbpcap_filters(&list, add_to_list);
+	/* Previous result would leak otherwise */
+	filters_free();
+
+	if (init_undocumented() == FALSE)
+	{
+		fprintf(stderr, "Failed to load ntdll.dll functions\n");
+	}
+	else
+	{
+		find_usbpcap_filters(&list, add_to_list);
+	}
 
 	usbpcapFilters = (struct filters**)malloc(sizeof(struct filters*) * (list.count + 1));
 	entry = list.head;
@@ -329,6 +347,7 @@ void filters_free()
 		i++;
 	}
 	free(usbpcapFilters);
+	usbpcapFilters = NULL;
 }
 
 BOOL is_usbpcap_upper_filter_installed()
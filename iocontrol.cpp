@@ -67,6 +67,20 @@ BOOLEAN USBPcapSetDeviceFiltered(PUSBPCAP_ADDRESS_FILTER filter, int address)
 	return TRUE;
 }
 
+BOOLEAN USBPcapClearDeviceFiltered(PUSBPCAP_ADDRESS_FILTER filter, int address)
+{
+	UINT8 range;
+	UINT8 index;
+
+	if (USBPcapGetAddressRangeAndIndex(address, &range, &index) == FALSE)
+	{
+		return FALSE;
+	}
+
+	filter->addresses[range] &= ~(1 << index);
+	return TRUE;
+}
+
 /*
  * Initializes address filter with given NULL-terminated, comma separated list of addresses.
  *
@@ -13,6 +13,7 @@
 
 BOOLEAN USBPcapIsDeviceFiltered(PUSBPCAP_ADDRESS_FILTER filter, int address);
 BOOLEAN USBPcapSetDeviceFiltered(PUSBPCAP_ADDRESS_FILTER filter, int address);
+BOOLEAN USBPcapClearDeviceFiltered(PUSBPCAP_ADDRESS_FILTER filter, int address);
 BOOLEAN USBPcapInitAddressFilter(PUSBPCAP_ADDRESS_FILTER filter, PCHAR list, BOOLEAN filterAll);
 
 #endif /* USBPCAP_CMD_IOCONTROL_H */
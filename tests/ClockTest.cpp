@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include <vector>
+
+#include "AwaitRegistry.h"
+#include "LoadShedder.h"
+#include "Test.h"
+#include "Timestamp.h"
+
+static CaptureRecord interruptRecord(USHORT device, UCHAR endpoint, UINT64 timestamp)
+{
+	CaptureRecord record;
+	memset(&record, 0, sizeof(record));
+
+	record.header.device = device;
+	record.header.endpoint = endpoint;
+	record.header.transfer = USBPCAP_TRANSFER_INTERRUPT;
+	record.timestamp = timestamp;
+
+	return record;
+}
+
+// Timeouts only move with the clock, not with the time the test takes.
+bool testAwaitTimeouts()
+{
+	ManualClock clock(1000 * NSEC_PER_SEC);
+	AwaitRegistry registry;
+	AwaitStatus timed = AwaitStatus::Completed;
+	AwaitStatus infinite = AwaitStatus::Completed;
+	int completions = 0;
+
+	registry.setClock(&clock);
+	registry.open();
+
+	CHECK(registry.nextTimeout() == INFINITE);
+
+	registry.awaitRecord([](const CaptureRecord&, const unsigned char*) { return false; }, 50,
+		[&](AwaitResult&& result) { timed = result.status; completions++; });
+	registry.awaitControl(-1, INFINITE,
+		[&](AwaitResult&& result) { infinite = result.status; completions++; });
+
+	CHECK(registry.nextTimeout() == 50);
+
+	// partial milliseconds round up
+	clock.advance(49 * NSEC_PER_MSEC + 500 * NSEC_PER_USEC);
+	CHECK(registry.nextTimeout() == 1);
+
+	registry.expire();
+	CHECK(completions == 0);
+
+	clock.advance(500 * NSEC_PER_USEC);
+	CHECK(registry.nextTimeout() == 0);
+
+	registry.expire();
+	CHECK(completions == 1);
+	CHECK(timed == AwaitStatus::TimedOut);
+	CHECK(registry.nextTimeout() == INFINITE);
+
+	clock.advance(3600 * NSEC_PER_SEC);
+	registry.expire();
+	CHECK(completions == 1);
+
+	registry.close();
+	CHECK(completions == 2);
+	CHECK(infinite == AwaitStatus::Stopped);
+
+	return true;
+}
+
+// Token bucket refill follows the record timestamps, taken from the clock.
+bool testLoadShedderRateLimit()
+{
+	ManualClock clock(1000 * NSEC_PER_SEC);
+	LoadShedder shedder;
+	std::vector<CaptureRecord> records;
+
+	CHECK(shedder.setRateLimit(1, 0x81, 100, 10));
+	CHECK(shedder.setRateLimit(1, 0x00, 100) == false);
+	CHECK(shedder.isEnabled());
+
+	// a full bucket passes the burst
+	records.assign(20, interruptRecord(1, 0x81, clock.now()));
+	CHECK(shedder.apply(records, 0, 1) == 10);
+
+	// 50 ms at 100 records/s
+	clock.advance(50 * NSEC_PER_MSEC);
+	records.assign(10, interruptRecord(1, 0x81, clock.now()));
+	CHECK(shedder.apply(records, 0, 1) == 5);
+
+	// refill stops at the burst
+	clock.advance(10 * NSEC_PER_SEC);
+	records.assign(20, interruptRecord(1, 0x81, clock.now()));
+	CHECK(shedder.apply(records, 0, 1) == 10);
+
+	// other endpoints are not limited
+	records.assign(20, interruptRecord(1, 0x82, clock.now()));
+	CHECK(shedder.apply(records, 0, 1) == 20);
+
+	CHECK(shedder.getShed(1, 0x81) == 25);
+	CHECK(shedder.getStats().rateLimited == 25);
+
+	return true;
+}
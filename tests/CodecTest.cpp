@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include <vector>
+
+#include "FastCodec.h"
+#include "Test.h"
+
+// Runs, short repeats and noise, roughly what interrupt payloads look like.
+static std::vector<UCHAR> mixedData(size_t size, UINT32 seed)
+{
+	std::vector<UCHAR> data(size);
+	UINT32 state = seed;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		state = state * 1103515245 + 12345;
+
+		switch ((i / 512) % 3)
+		{
+		case 0:
+			data[i] = 0xAA;
+			break;
+		case 1:
+			data[i] = (UCHAR)(i % 7);
+			break;
+		default:
+			data[i] = (UCHAR)(state >> 16);
+			break;
+		}
+	}
+
+	return data;
+}
+
+static bool roundTrip(const std::vector<UCHAR>& data, size_t& compressedSize)
+{
+	std::vector<UCHAR> compressed(fastCompressBound(data.size()));
+	std::vector<UCHAR> decompressed(data.size());
+
+	compressedSize = fastCompress(data.data(), data.size(), compressed.data(), compressed.size());
+	CHECK(compressedSize > 0 && compressedSize <= compressed.size());
+
+	CHECK(fastDecompress(compressed.data(), compressedSize, decompressed.data(), decompressed.size()));
+	CHECK(decompressed == data);
+
+	// the decoded size is part of the contract
+	std::vector<UCHAR> larger(data.size() + 1);
+	CHECK(fastDecompress(compressed.data(), compressedSize, larger.data(), larger.size()) == false);
+
+	return true;
+}
+
+bool testFastCodecRoundTrip()
+{
+	size_t compressedSize;
+
+	// shorter than a match may start, literals only
+	for (size_t size = 0; size <= 16; size++)
+	{
+		CHECK(roundTrip(mixedData(size, (UINT32)size), compressedSize));
+	}
+
+	std::vector<UCHAR> run(64 * 1024, 0x55);
+	CHECK(roundTrip(run, compressedSize));
+	CHECK(compressedSize < run.size() / 100);
+
+	std::vector<UCHAR> mixed = mixedData(200000, 1);
+	CHECK(roundTrip(mixed, compressedSize));
+	CHECK(compressedSize < mixed.size());
+
+	// noise only grows up to the bound
+	std::vector<UCHAR> noise(100000);
+	UINT32 state = 7;
+	for (auto& byte : noise)
+	{
+		state = state * 1103515245 + 12345;
+		byte = (UCHAR)(state >> 16);
+	}
+	CHECK(roundTrip(noise, compressedSize));
+
+	std::vector<UCHAR> small(fastCompressBound(mixed.size()) - 1);
+	CHECK(fastCompress(mixed.data(), mixed.size(), small.data(), small.size()) == 0);
+
+	// a cut block can't decode to the full size
+	std::vector<UCHAR> compressed(fastCompressBound(mixed.size()));
+	std::vector<UCHAR> decompressed(mixed.size());
+	compressedSize = fastCompress(mixed.data(), mixed.size(), compressed.data(), compressed.size());
+
+	for (size_t cut = 1; cut < 64; cut++)
+	{
+		CHECK(fastDecompress(compressed.data(), compressedSize - cut, decompressed.data(), decompressed.size()) == false);
+	}
+
+	return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string.h>
+
+#include <vector>
+
+#include "CaptureRecord.h"
+
+// Control transfers of one bus as the driver captures them.
+class ControlTraffic
+{
+public:
+	explicit ControlTraffic(USHORT bus)
+		: bus(bus)
+	{
+	}
+
+	// record timestamps from now on
+	void setTime(UINT32 seconds)
+	{
+		this->seconds = seconds;
+	}
+
+	void submit(USHORT device, UINT64 irpId, const unsigned char* setup)
+	{
+		append(device, irpId, 0, USBPCAP_CONTROL_STAGE_SETUP, setup, 8);
+	}
+
+	void complete(USHORT device, UINT64 irpId, const unsigned char* data, USHORT length)
+	{
+		append(device, irpId, 1, USBPCAP_CONTROL_STAGE_COMPLETE, data, length);
+	}
+
+	void getDeviceDescriptor(USHORT device, UINT64 irpId, const unsigned char* descriptor, USHORT length = 18)
+	{
+		const unsigned char setup[8] = { 0x80, 0x06, 0x00, 0x01, 0x00, 0x00, (unsigned char)length, 0x00 };
+
+		submit(device, irpId, setup);
+		complete(device, irpId, descriptor, length);
+	}
+
+	// moves the device at the default address
+	void setAddress(UINT64 irpId, UCHAR address)
+	{
+		const unsigned char setup[8] = { 0x00, 0x05, address, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+		submit(0, irpId, setup);
+		complete(0, irpId, setup, 0);
+	}
+
+	// Parses what was appended since the last call, buffer stays valid until the next one.
+	RecordBatch take(std::vector<CaptureRecord>& records)
+	{
+		taken.swap(buffer);
+		buffer.clear();
+
+		parseRecords(taken.data(), (DWORD)taken.size(), 0, 0, records);
+
+		RecordBatch batch = {};
+		batch.buffer = taken.data();
+		batch.bytes = (DWORD)taken.size();
+		batch.records = records.data();
+		batch.count = records.size();
+
+		return batch;
+	}
+
+private:
+	void append(USHORT device, UINT64 irpId, UCHAR info, UCHAR stage, const unsigned char* data, USHORT length)
+	{
+		USBPCAP_BUFFER_CONTROL_HEADER header;
+		memset(&header, 0, sizeof(header));
+		header.header.headerLen = sizeof(header);
+		header.header.irpId = irpId;
+		header.header.info = info;
+		header.header.bus = bus;
+		header.header.device = device;
+		header.header.transfer = USBPCAP_TRANSFER_CONTROL;
+		header.header.dataLength = length;
+		header.stage = stage;
+
+		pcaprec_hdr_t record;
+		memset(&record, 0, sizeof(record));
+		record.ts_sec = seconds;
+		record.incl_len = record.orig_len = sizeof(header) + length;
+
+		const unsigned char* bytes = (const unsigned char*)&record;
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(record));
+		bytes = (const unsigned char*)&header;
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(header));
+		buffer.insert(buffer.end(), data, data + length);
+	}
+
+private:
+	USHORT bus;
+	UINT32 seconds = 0;
+
+	std::vector<unsigned char> buffer;
+	std::vector<unsigned char> taken;
+};
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "FlightRecorder.h"
+#include "Test.h"
+
+#define FLIGHT_TEST_CAPACITY (64 * 1024)
+#define FLIGHT_TEST_SNAPLEN  1024
+#define FLIGHT_TEST_PAYLOAD  200
+
+// Record n is stamped n seconds after 1000 s.
+static void recordBatch(int first, int count, std::vector<unsigned char>& buffer, std::vector<CaptureRecord>& records, RecordBatch& batch)
+{
+	buffer.clear();
+
+	for (int n = first; n < first + count; n++)
+	{
+		USBPCAP_BUFFER_PACKET_HEADER header;
+		memset(&header, 0, sizeof(header));
+		header.headerLen = sizeof(header);
+		header.transfer = USBPCAP_TRANSFER_BULK;
+		header.dataLength = FLIGHT_TEST_PAYLOAD;
+
+		pcaprec_hdr_t record;
+		record.ts_sec = 1000 + n;
+		record.ts_usec = 0;
+		record.incl_len = record.orig_len = sizeof(header) + FLIGHT_TEST_PAYLOAD;
+
+		const unsigned char* bytes = (const unsigned char*)&record;
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(record));
+		bytes = (const unsigned char*)&header;
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(header));
+		buffer.insert(buffer.end(), FLIGHT_TEST_PAYLOAD, (unsigned char)n);
+	}
+
+	parseRecords(buffer.data(), (DWORD)buffer.size(), 0, 0, records);
+
+	memset(&batch, 0, sizeof(batch));
+	batch.buffer = buffer.data();
+	batch.bytes = (DWORD)buffer.size();
+	batch.records = records.data();
+	batch.count = records.size();
+}
+
+static bool record(FlightRecorder& recorder, int first, int count)
+{
+	std::vector<unsigned char> buffer;
+	std::vector<CaptureRecord> records;
+	RecordBatch batch;
+
+	recordBatch(first, count, buffer, records, batch);
+	CHECK(batch.count == (size_t)count);
+
+	recorder.consume(batch);
+
+	return true;
+}
+
+// Returns the record numbers of an exported capture, false if it is damaged.
+static bool readExport(const std::string& path, std::vector<int>& numbers)
+{
+	numbers.clear();
+
+	FILE* file = fopen(path.c_str(), "rb");
+	CHECK(file != nullptr);
+
+	pcap_hdr_t header;
+	bool intact = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic_number == PCAP_MAGIC_NUMBER && header.network == DLT_USBPCAP;
+
+	pcaprec_hdr_t record;
+	std::vector<unsigned char> packet;
+
+	while (intact && fread(&record, sizeof(record), 1, file) == 1)
+	{
+		packet.resize(record.incl_len);
+
+		int n = (int)record.ts_sec - 1000;
+		intact = record.incl_len == sizeof(USBPCAP_BUFFER_PACKET_HEADER) + FLIGHT_TEST_PAYLOAD &&
+			fread(packet.data(), 1, packet.size(), file) == packet.size() &&
+			packet.back() == (unsigned char)n;
+
+		numbers.push_back(n);
+	}
+
+	fclose(file);
+	remove(path.c_str());
+
+	return intact;
+}
+
+static bool isRun(const std::vector<int>& numbers, int first, int last)
+{
+	if (numbers.empty() || numbers.front() != first || numbers.back() != last)
+	{
+		return false;
+	}
+
+	for (size_t i = 1; i < numbers.size(); i++)
+	{
+		if (numbers[i] != numbers[i - 1] + 1)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool checkRecorder(const std::string& ring, const std::string& dump)
+{
+	FlightRecorder recorder;
+	std::vector<int> numbers;
+
+	CHECK(recorder.open(ring, FLIGHT_TEST_CAPACITY, FlightRecorderOptions(), FLIGHT_TEST_SNAPLEN));
+
+	CHECK(recorder.exportWindow(dump));
+	CHECK(readExport(dump, numbers));
+	CHECK(numbers.empty());
+
+	// several times around the ring, in batches of different sizes
+	for (int n = 0; n < 1000; )
+	{
+		int count = (std::min)(1 + n % 7, 1000 - n);
+
+		CHECK(record(recorder, n, count));
+		n += count;
+	}
+
+	FlightRecorderStats stats = recorder.getStats();
+	CHECK(stats.records == 1000);
+	CHECK(stats.evicted > 0 && stats.evicted < 1000);
+
+	// the newest records survived, in order and without gaps
+	CHECK(recorder.exportWindow(dump));
+	CHECK(readExport(dump, numbers));
+	CHECK(isRun(numbers, (int)stats.evicted, 999));
+	int oldest = numbers.front();
+
+	CHECK(recorder.exportWindow(dump, pcapTimestampToNs(1000 + 990, 0)));
+	CHECK(readExport(dump, numbers));
+	CHECK(isRun(numbers, 990, 999));
+
+	recorder.close();
+
+	// a reopened recording holds what was there before and goes on from it
+	CHECK(recorder.open(ring, FLIGHT_TEST_CAPACITY, FlightRecorderOptions(), FLIGHT_TEST_SNAPLEN));
+
+	CHECK(recorder.exportWindow(dump));
+	CHECK(readExport(dump, numbers));
+	CHECK(isRun(numbers, oldest, 999));
+
+	CHECK(record(recorder, 1000, 5));
+	CHECK(recorder.exportWindow(dump, pcapTimestampToNs(1000 + 998, 0)));
+	CHECK(readExport(dump, numbers));
+	CHECK(isRun(numbers, 998, 1004));
+
+	recorder.close();
+
+	// another capacity starts over
+	CHECK(recorder.open(ring, FLIGHT_TEST_CAPACITY * 2, FlightRecorderOptions(), FLIGHT_TEST_SNAPLEN));
+	CHECK(recorder.exportWindow(dump));
+	CHECK(readExport(dump, numbers));
+	CHECK(numbers.empty());
+
+	return true;
+}
+
+// Wrapping keeps the newest records, a reopened file continues the recording.
+bool testFlightRecorderRecovery()
+{
+	const std::string ring = "USBPcapHelperTest.ring";
+	const std::string dump = "USBPcapHelperTest-flight.pcap";
+
+	remove(ring.c_str());
+
+	bool passed = checkRecorder(ring, dump);
+
+	remove(ring.c_str());
+	remove(dump.c_str());
+
+	return passed;
+}
@@ -0,0 +1,70 @@
+#include <vector>
+
+#include "ControlTraffic.h"
+#include "DeviceIdentityMap.h"
+#include "Test.h"
+
+#define IDENTITY_TEST_BUS 30
+
+static DeviceIdentity observe(ControlTraffic& traffic, USHORT address)
+{
+	std::vector<CaptureRecord> records;
+
+	DeviceIdentityMap::instance().observe(traffic.take(records));
+
+	return DeviceIdentityMap::instance().lookup(IDENTITY_TEST_BUS, address);
+}
+
+// Identities follow SET_ADDRESS, the generation changes whenever an address
+// is given to another device and stays while the same device is described again.
+bool testDeviceIdentityRebind()
+{
+	unsigned char descriptor[18] = { 18, 1, 0x00, 0x02, 0, 0, 0, 64, 0x34, 0x12, 0x78, 0x56, 0x00, 0x01, 1, 2, 3, 1 };
+	ControlTraffic traffic(IDENTITY_TEST_BUS);
+
+	DeviceIdentityMap::instance().clear(IDENTITY_TEST_BUS);
+	CHECK(observe(traffic, 7).isKnown() == false);
+
+	traffic.getDeviceDescriptor(0, 1, descriptor);
+	traffic.setAddress(2, 7);
+
+	DeviceIdentity identity = observe(traffic, 7);
+	CHECK(identity.isKnown());
+	CHECK(identity.idVendor == 0x1234 && identity.idProduct == 0x5678 && identity.bcdDevice == 0x0100);
+	CHECK(identity.generation == 1);
+
+	// a completion without its SETUP is not a descriptor
+	descriptor[8] = 0x99;
+	traffic.complete(7, 9, descriptor, 18);
+	identity = observe(traffic, 7);
+	CHECK(identity.idVendor == 0x1234 && identity.generation == 1);
+
+	// a device not described yet takes the address over
+	traffic.setAddress(3, 7);
+	identity = observe(traffic, 7);
+	CHECK(identity.isKnown() == false && identity.generation == 2);
+
+	// and is described at its own address
+	traffic.getDeviceDescriptor(7, 4, descriptor);
+	identity = observe(traffic, 7);
+	CHECK(identity.idVendor == 0x1299 && identity.generation == 2);
+
+	// the same device described again keeps its generation
+	traffic.getDeviceDescriptor(7, 5, descriptor);
+	identity = observe(traffic, 7);
+	CHECK(identity.idVendor == 0x1299 && identity.generation == 2);
+
+	// another device at the same address
+	descriptor[8] = 0x55;
+	traffic.getDeviceDescriptor(0, 6, descriptor);
+	traffic.setAddress(7, 7);
+	identity = observe(traffic, 7);
+	CHECK(identity.idVendor == 0x1255 && identity.generation == 3);
+
+	CHECK(DeviceIdentityMap::instance().lookup(IDENTITY_TEST_BUS, 8).isKnown() == false);
+
+	DeviceIdentityMap::instance().clear(IDENTITY_TEST_BUS);
+	CHECK(observe(traffic, 7).isKnown() == false);
+
+	return true;
+}
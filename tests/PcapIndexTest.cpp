@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "PcapWriter.h"
+#include "Test.h"
+
+#define INDEX_TEST_RECORDS       500
+#define INDEX_TEST_BLOCK_RECORDS 16
+
+// Record n: device n % 5, endpoint 0x81 or 0x02, ten records per second.
+static void appendRecord(std::vector<unsigned char>& buffer, int n)
+{
+	USBPCAP_BUFFER_PACKET_HEADER header;
+	memset(&header, 0, sizeof(header));
+	header.headerLen = sizeof(header);
+	header.device = (USHORT)(n % 5);
+	header.endpoint = (n % 2) ? 0x81 : 0x02;
+	header.transfer = USBPCAP_TRANSFER_INTERRUPT;
+	header.dataLength = sizeof(n);
+
+	pcaprec_hdr_t record;
+	record.ts_sec = 1000 + n / 10;
+	record.ts_usec = (n % 10) * 100000;
+	record.incl_len = record.orig_len = sizeof(header) + sizeof(n);
+
+	const unsigned char* bytes = (const unsigned char*)&record;
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(record));
+	bytes = (const unsigned char*)&header;
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(header));
+	bytes = (const unsigned char*)&n;
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(n));
+}
+
+static bool writeCapture(const std::string& path, bool compression)
+{
+	PcapWriter writer;
+	writer.setCompression(compression);
+	CHECK(writer.open(path, 65535, INDEX_TEST_BLOCK_RECORDS));
+
+	std::vector<CaptureRecord> records;
+
+	// batches don't line up with index blocks
+	for (int first = 0; first < INDEX_TEST_RECORDS; first += 37)
+	{
+		std::vector<unsigned char> buffer;
+
+		for (int n = first; n < first + 37 && n < INDEX_TEST_RECORDS; n++)
+		{
+			appendRecord(buffer, n);
+		}
+
+		parseRecords(buffer.data(), (DWORD)buffer.size(), 0, 0, records);
+
+		RecordBatch batch = {};
+		batch.buffer = buffer.data();
+		batch.bytes = (DWORD)buffer.size();
+		batch.records = records.data();
+		batch.count = records.size();
+
+		writer.consume(batch);
+	}
+
+	CHECK(writer.getRecordsWritten() == INDEX_TEST_RECORDS);
+	writer.close();
+
+	return true;
+}
+
+static bool queryCapture(const std::string& path)
+{
+	PcapIndexReader reader;
+	CHECK(reader.open(path));
+	CHECK(reader.getBlocks().size() == (INDEX_TEST_RECORDS + INDEX_TEST_BLOCK_RECORDS - 1) / INDEX_TEST_BLOCK_RECORDS);
+
+	PcapIndexQuery all;
+	CHECK(reader.query(all, [](const CaptureRecord&, const unsigned char*) {}) == INDEX_TEST_RECORDS);
+
+	PcapIndexQuery query;
+	query.device = 3;
+	query.endpoint = 0x81;
+	query.from = pcapTimestampToNs(1010, 0);
+	query.to = pcapTimestampToNs(1019, 0);
+
+	// blocks outside the time range are skipped without reading them
+	CHECK(reader.findBlocks(query).size() < reader.getBlocks().size() / 2);
+
+	int expected = 0;
+	for (int n = 0; n < INDEX_TEST_RECORDS; n++)
+	{
+		UINT64 timestamp = pcapTimestampToNs(1000 + n / 10, (n % 10) * 100000);
+
+		if (n % 5 == 3 && n % 2 == 1 && timestamp >= query.from && timestamp <= query.to)
+		{
+			expected++;
+		}
+	}
+
+	bool intact = true;
+	long long matched = reader.query(query, [&intact](const CaptureRecord& record, const unsigned char* packet)
+	{
+		int n;
+		memcpy(&n, &packet[record.payloadOffset], sizeof(n));
+
+		intact = intact && record.payloadLength == sizeof(n) && n % 5 == 3 && n % 2 == 1 &&
+			record.timestamp == pcapTimestampToNs(1000 + n / 10, (n % 10) * 100000);
+	});
+
+	CHECK(intact);
+	CHECK(matched == expected);
+
+	return true;
+}
+
+// The index names every block that may hold a match, whether the capture is compressed or not.
+bool testPcapIndexQuery()
+{
+	const std::string path = "USBPcapHelperTest.pcap";
+	bool passed = true;
+
+	for (int compression = 0; compression < 2 && passed; compression++)
+	{
+		passed = writeCapture(path, compression != 0) && queryCapture(path);
+	}
+
+	remove(path.c_str());
+	remove((path + PCAP_INDEX_EXTENSION).c_str());
+
+	return passed;
+}
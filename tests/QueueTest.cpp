@@ -0,0 +1,166 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "BatchQueue.h"
+#include "BroadcastRing.h"
+#include "Test.h"
+
+static bool pushBatch(BatchQueue& queue, BufferPool& pool)
+{
+	std::vector<CaptureRecord> records(1);
+	CaptureBuffer* buffer = pool.acquire();
+
+	// the queue retains what it keeps, the reader's reference goes back right away
+	bool pushed = queue.push(buffer, 16, records);
+	pool.release(buffer);
+
+	return pushed;
+}
+
+// Nothing is queued while closed, what was queued before close() can still
+// be pulled, and every buffer is back in the pool once released.
+bool testBatchQueueClose()
+{
+	BufferPool pool;
+	CHECK(pool.configure(4096));
+
+	{
+		BatchQueue queue;
+		queue.configure(&pool, 2);
+
+		CHECK(pushBatch(queue, pool) == false);
+
+		queue.open();
+		CHECK(pushBatch(queue, pool));
+		CHECK(pushBatch(queue, pool));
+		CHECK(pushBatch(queue, pool) == false);
+		CHECK(queue.getStats().dropped == 1);
+
+		queue.close();
+		CHECK(pushBatch(queue, pool) == false);
+
+		PulledBatch* first = queue.pop(0);
+		PulledBatch* second = queue.pop(0);
+		CHECK(first != nullptr && second != nullptr);
+		CHECK(first->size() == 1);
+		CHECK(queue.pop(INFINITE) == nullptr);
+
+		CHECK(queue.getStats().outstanding == 2);
+		queue.release(first);
+		queue.release(second);
+		CHECK(pool.getStats().inUse == 0);
+
+		// reopened for the next capture
+		queue.open();
+		CHECK(queue.pop(10) == nullptr);
+		CHECK(pushBatch(queue, pool));
+
+		PulledBatch* batch = queue.pop(INFINITE);
+		CHECK(batch != nullptr);
+		queue.release(batch);
+
+		// close() wakes a consumer waiting for the next batch
+		PulledBatch* waited = batch;
+		std::thread consumer([&queue, &waited]() { waited = queue.pop(INFINITE); });
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		queue.close();
+		consumer.join();
+
+		CHECK(waited == nullptr);
+		CHECK(queue.getStats().pulled == 3);
+	}
+
+	CHECK(pool.getStats().inUse == 0);
+
+	return true;
+}
+
+static bool publishBatch(BroadcastRing& ring, BufferPool& pool)
+{
+	std::vector<CaptureRecord> records(1);
+	CaptureBuffer* buffer = pool.acquire();
+
+	bool published = ring.publish(buffer, 16, records);
+	pool.release(buffer);
+
+	return published;
+}
+
+// Consumers see every batch of every run, and a consumer that stopped the
+// ring from its own handler keeps it from restarting until it returned.
+bool testBroadcastRingRestart()
+{
+	BufferPool pool;
+	CHECK(pool.configure(4096));
+
+	BroadcastRing ring;
+	ring.configure(&pool, 4);
+
+	std::atomic<int> handled[2] = {};
+	ring.addConsumer([&handled](const RecordBatch&) { handled[0]++; });
+	ring.addConsumer([&handled](const RecordBatch&) { handled[1]++; });
+
+	for (int run = 1; run <= 2; run++)
+	{
+		CHECK(ring.start());
+		CHECK(publishBatch(ring, pool));
+		CHECK(publishBatch(ring, pool));
+		ring.close();
+		ring.join();
+
+		CHECK(publishBatch(ring, pool) == false);
+		CHECK(handled[0] == 2 * run && handled[1] == 2 * run);
+		CHECK(pool.getStats().inUse == 0);
+	}
+
+	BroadcastRing stopping;
+	stopping.configure(&pool, 4);
+
+	std::atomic<bool> stopped{ false };
+	std::atomic<bool> finish{ false };
+	bool restarted = true;
+
+	stopping.addConsumer([&](const RecordBatch&)
+	{
+		stopping.close();
+		stopping.join();
+		restarted = stopping.start();
+		stopped = true;
+
+		while (finish == false)
+		{
+			std::this_thread::yield();
+		}
+	});
+
+	CHECK(stopping.start());
+	CHECK(publishBatch(stopping, pool));
+
+	while (stopped == false)
+	{
+		std::this_thread::yield();
+	}
+
+	bool startedWhileRunning = stopping.start();
+	finish = true;
+
+	CHECK(restarted == false);
+	CHECK(startedWhileRunning == false);
+
+	// the detached consumer is done soon after its handler returned
+	bool started = false;
+	for (int i = 0; i < 1000 && started == false; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		started = stopping.start();
+	}
+
+	CHECK(started);
+	stopping.close();
+	stopping.join();
+
+	return true;
+}
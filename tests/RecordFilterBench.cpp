@@ -0,0 +1,131 @@
+#include <random>
+#include <vector>
+
+#include "RecordFilter.h"
+#include "RecordIndex.h"
+#include "Test.h"
+#include "Timestamp.h"
+
+#define BENCH_RECORDS 1000000
+#define BENCH_ROUNDS  50
+
+static const char* kernelName(RecordFilterKernel kernel)
+{
+	switch (kernel)
+	{
+	case RecordFilterKernel::AVX2:
+		return "AVX2";
+
+	case RecordFilterKernel::SSE41:
+		return "SSE4.1";
+
+	default:
+		return "scalar";
+	}
+}
+
+// Synthetic stream resembling a busy root hub: a few devices, mostly bulk and
+// interrupt traffic on their first endpoints, control in between.
+static void streamRecords(std::vector<CaptureRecord>& records)
+{
+	std::mt19937 random(1);
+
+	records.resize(BENCH_RECORDS);
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		CaptureRecord& record = records[i];
+		memset(&record, 0, sizeof(record));
+
+		UINT32 kind = random() % 10;
+
+		record.header.device = (USHORT)(1 + random() % 6);
+		record.header.transfer = (kind < 5) ? USBPCAP_TRANSFER_BULK : (kind < 9) ? USBPCAP_TRANSFER_INTERRUPT : USBPCAP_TRANSFER_CONTROL;
+		record.header.endpoint = (record.header.transfer == USBPCAP_TRANSFER_CONTROL) ? 0x80 : (UCHAR)(0x81 + random() % 2);
+		record.payloadLength = (record.header.transfer == USBPCAP_TRANSFER_BULK) ? 512 : random() % 64;
+		record.timestamp = i * 125 * NSEC_PER_USEC;
+	}
+}
+
+// One predicate evaluated over the same index with every kernel the CPU has.
+static bool benchPredicate(const char* name, const RecordIndex& index, const RecordPredicate& predicate)
+{
+	const RecordFilterKernel kernels[] = { RecordFilterKernel::Scalar, RecordFilterKernel::SSE41, RecordFilterKernel::AVX2 };
+
+	MonotonicClock& clock = MonotonicClock::instance();
+	std::vector<UINT64> selection;
+	RecordFilter filter(predicate);
+	size_t expected = 0;
+	double scalarTime = 0;
+
+	for (RecordFilterKernel kernel : kernels)
+	{
+		if (kernel > RecordFilter::detectKernel())
+		{
+			continue;
+		}
+
+		filter.setKernel(kernel);
+
+		size_t selected = filter.evaluate(index, selection);
+		UINT64 start = clock.now();
+
+		for (int round = 0; round < BENCH_ROUNDS; round++)
+		{
+			filter.evaluate(index, selection);
+		}
+
+		double perRecord = (double)(clock.now() - start) / BENCH_ROUNDS / index.size();
+
+		if (kernel == RecordFilterKernel::Scalar)
+		{
+			expected = selected;
+			scalarTime = perRecord;
+		}
+
+		printf("%-24s %-7s %7.3f ns/record %8.1f Mrecords/s %5.2fx  %zu selected\n", name, kernelName(kernel),
+			perRecord, 1000.0 / perRecord, scalarTime / perRecord, selected);
+
+		CHECK(selected == expected);
+	}
+
+	return true;
+}
+
+bool benchRecordFilter()
+{
+	std::vector<CaptureRecord> records;
+	streamRecords(records);
+
+	RecordBatch batch = {};
+	batch.records = records.data();
+	batch.count = records.size();
+
+	RecordIndex index;
+	index.build(batch);
+
+	RecordPredicate device;
+	device.device = 3;
+
+	RecordPredicate endpoint;
+	endpoint.device = 3;
+	endpoint.endpoint = 0x81;
+
+	RecordPredicate interrupt;
+	interrupt.transferMask = RECORD_TRANSFER_BIT(USBPCAP_TRANSFER_INTERRUPT);
+	interrupt.minLength = 8;
+	interrupt.maxLength = 32;
+
+	RecordPredicate all;
+	all.device = 2;
+	all.endpoint = 0x82;
+	all.transferMask = RECORD_TRANSFER_BIT(USBPCAP_TRANSFER_BULK) | RECORD_TRANSFER_BIT(USBPCAP_TRANSFER_INTERRUPT);
+	all.minLength = 1;
+
+	printf("%d records, %d rounds\n", BENCH_RECORDS, BENCH_ROUNDS);
+
+	return benchPredicate("device", index, device) &&
+		benchPredicate("device and endpoint", index, endpoint) &&
+		benchPredicate("interrupt length range", index, interrupt) &&
+		benchPredicate("all fields", index, all);
+}
@@ -0,0 +1,179 @@
+#include <random>
+#include <vector>
+
+#include "RecordFilter.h"
+#include "RecordIndex.h"
+#include "Test.h"
+
+static const UCHAR transfers[] =
+{
+	USBPCAP_TRANSFER_ISOCHRONOUS,
+	USBPCAP_TRANSFER_INTERRUPT,
+	USBPCAP_TRANSFER_CONTROL,
+	USBPCAP_TRANSFER_BULK,
+	USBPCAP_TRANSFER_IRP_INFO,
+	USBPCAP_TRANSFER_UNKNOWN,
+};
+
+static const UCHAR endpoints[] = { 0x00, 0x80, 0x01, 0x81, 0x02, 0x83 };
+
+// Headers from a small value range so that every predicate matches some of them.
+static void randomRecords(std::mt19937& random, size_t count, std::vector<CaptureRecord>& records)
+{
+	records.resize(count);
+
+	for (auto& record : records)
+	{
+		memset(&record, 0, sizeof(record));
+
+		record.header.device = (USHORT)(random() % 8);
+		record.header.endpoint = endpoints[random() % sizeof(endpoints)];
+		record.header.transfer = transfers[random() % sizeof(transfers)];
+		record.payloadLength = (random() % 4 == 0) ? 0 : random() % 2048;
+		record.timestamp = random();
+	}
+}
+
+static RecordPredicate randomPredicate(std::mt19937& random)
+{
+	RecordPredicate predicate;
+
+	if (random() % 2)
+	{
+		predicate.device = random() % 9;
+	}
+
+	if (random() % 2)
+	{
+		predicate.endpoint = endpoints[random() % sizeof(endpoints)];
+	}
+
+	if (random() % 2)
+	{
+		predicate.transferMask = (UCHAR)(random() % 16);
+	}
+
+	if (random() % 2)
+	{
+		predicate.minLength = random() % 1024;
+	}
+
+	if (random() % 2)
+	{
+		predicate.maxLength = random() % 2048;
+	}
+
+	return predicate;
+}
+
+// written against the predicate definition, not RecordFilter::accept()
+static bool matches(const RecordPredicate& predicate, const CaptureRecord& record)
+{
+	bool transferMatches = predicate.transferMask == RECORD_TRANSFER_ANY ||
+		(record.header.transfer <= USBPCAP_TRANSFER_BULK && (predicate.transferMask & (1 << record.header.transfer)) != 0);
+
+	return (predicate.device == RECORD_ANY_DEVICE || record.header.device == predicate.device) &&
+		(predicate.endpoint == RECORD_ANY_ENDPOINT || record.header.endpoint == predicate.endpoint) &&
+		transferMatches &&
+		record.payloadLength >= predicate.minLength && record.payloadLength <= predicate.maxLength;
+}
+
+static RecordBatch makeBatch(const std::vector<CaptureRecord>& records)
+{
+	RecordBatch batch = {};
+	batch.records = records.data();
+	batch.count = records.size();
+
+	return batch;
+}
+
+// Every kernel the CPU has must select exactly the records the scalar one does.
+bool testRecordFilterKernels()
+{
+	std::mt19937 random(37);
+	std::vector<CaptureRecord> records;
+	std::vector<UINT64> expected;
+	std::vector<UINT64> selection;
+	RecordIndex index;
+
+	const RecordFilterKernel kernels[] = { RecordFilterKernel::SSE41, RecordFilterKernel::AVX2 };
+
+	for (int round = 0; round < 500; round++)
+	{
+		// lengths that are no multiple of the vector width leave a scalar tail
+		randomRecords(random, random() % 300, records);
+		index.build(makeBatch(records));
+
+		RecordPredicate predicate = randomPredicate(random);
+		RecordFilter filter(predicate);
+
+		filter.setKernel(RecordFilterKernel::Scalar);
+		size_t selected = filter.evaluate(index, expected);
+
+		size_t reference = 0;
+
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			bool bit = (expected[i / 64] & (1ULL << (i % 64))) != 0;
+
+			CHECK(bit == matches(predicate, records[i]));
+			reference += bit ? 1 : 0;
+		}
+
+		CHECK(selected == reference);
+
+		for (RecordFilterKernel kernel : kernels)
+		{
+			if (kernel > RecordFilter::detectKernel())
+			{
+				continue;
+			}
+
+			filter.setKernel(kernel);
+
+			CHECK(filter.evaluate(index, selection) == selected);
+			CHECK(selection == expected);
+		}
+	}
+
+	return true;
+}
+
+bool testRecordFilterSelect()
+{
+	std::mt19937 random(41);
+	std::vector<CaptureRecord> records;
+	std::vector<UINT64> selection;
+	RecordIndex index;
+
+	randomRecords(random, 1000, records);
+
+	RecordPredicate predicate;
+	predicate.device = 3;
+	predicate.transferMask = RECORD_TRANSFER_BIT(USBPCAP_TRANSFER_INTERRUPT) | RECORD_TRANSFER_BIT(USBPCAP_TRANSFER_BULK);
+	predicate.minLength = 1;
+
+	std::vector<CaptureRecord> expected;
+
+	for (auto& record : records)
+	{
+		if (matches(predicate, record))
+		{
+			expected.push_back(record);
+		}
+	}
+
+	index.build(makeBatch(records));
+
+	RecordFilter filter(predicate);
+
+	CHECK(filter.select(index, records, selection) == expected.size());
+	CHECK(records.size() == expected.size());
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		CHECK(records[i].timestamp == expected[i].timestamp);
+	}
+
+	return true;
+}
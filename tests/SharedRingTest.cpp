@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "SharedRing.h"
+#include "Test.h"
+
+#define RING_TEST_ENTRIES 200000
+#define RING_TEST_READERS 2
+
+// Entry n carries n followed by a pattern, its length depends on n as well.
+static uint32_t entryLength(uint64_t n)
+{
+	return (uint32_t)(sizeof(uint64_t) + n % 300);
+}
+
+static void fillEntry(uint64_t n, std::vector<uint8_t>& entry)
+{
+	entry.resize(entryLength(n));
+	memcpy(entry.data(), &n, sizeof(n));
+
+	for (size_t i = sizeof(n); i < entry.size(); i++)
+	{
+		entry[i] = (uint8_t)(n * 31 + i);
+	}
+}
+
+static bool checkEntry(const std::vector<uint8_t>& entry, uint64_t& n)
+{
+	if (entry.size() < sizeof(n))
+	{
+		return false;
+	}
+
+	memcpy(&n, entry.data(), sizeof(n));
+
+	std::vector<uint8_t> expected;
+	fillEntry(n, expected);
+
+	return entry == expected;
+}
+
+struct ReaderResult
+{
+	bool intact = true;
+	bool ordered = true;
+	uint64_t received = 0;
+	SharedRingStats stats = {};
+};
+
+static void readRing(const char* name, ReaderResult& result)
+{
+	SharedRingReader reader;
+	std::vector<uint8_t> entry;
+	uint64_t previous = 0;
+	bool first = true;
+
+	if (reader.open(name, true) == false)
+	{
+		result.intact = false;
+		return;
+	}
+
+	while (true)
+	{
+		// closed is checked before reading so that nothing committed is missed
+		bool closed = reader.isWriterClosed();
+
+		if (reader.read(entry) == false)
+		{
+			if (closed)
+			{
+				break;
+			}
+
+			std::this_thread::yield();
+			continue;
+		}
+
+		uint64_t n;
+
+		if (checkEntry(entry, n) == false)
+		{
+			result.intact = false;
+		}
+
+		if (first == false && n <= previous)
+		{
+			result.ordered = false;
+		}
+
+		previous = n;
+		first = false;
+		result.received++;
+	}
+
+	result.stats = reader.getStats();
+}
+
+// Readers racing a writer on a small ring: everything they return is intact
+// and in order, whatever was overwritten is counted as lost.
+bool testSharedRingLoad()
+{
+	const char* name = "USBPcapHelperTest-load";
+
+	SharedRingWriter writer;
+	CHECK(writer.create(name, 64 * 1024));
+
+	// the name is taken while the writer has it
+	SharedRingWriter second;
+	CHECK(second.create(name, 64 * 1024) == false);
+
+	ReaderResult results[RING_TEST_READERS];
+	std::thread readers[RING_TEST_READERS];
+
+	for (int i = 0; i < RING_TEST_READERS; i++)
+	{
+		readers[i] = std::thread(readRing, name, std::ref(results[i]));
+	}
+
+	std::vector<uint8_t> entry;
+	bool written = true;
+
+	for (uint64_t n = 0; n < RING_TEST_ENTRIES; n++)
+	{
+		fillEntry(n, entry);
+		written = writer.write(entry.data(), (uint32_t)entry.size()) && written;
+
+		// give the readers a chance now and then, they are lapped often all the same
+		if (n % 256 == 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	SharedRingReader late;
+	bool opened = late.open(name, true);
+
+	// readers drain what is left once they see the writer closed
+	writer.close();
+
+	for (int i = 0; i < RING_TEST_READERS; i++)
+	{
+		readers[i].join();
+	}
+
+	CHECK(written);
+	CHECK(opened);
+
+	for (int i = 0; i < RING_TEST_READERS; i++)
+	{
+		CHECK(results[i].intact);
+		CHECK(results[i].ordered);
+		CHECK(results[i].received == results[i].stats.entries);
+		CHECK(results[i].stats.entries + results[i].stats.lost <= RING_TEST_ENTRIES);
+	}
+
+	// a reader that never kept up still gets the newest entries intact
+	uint64_t n = 0;
+	uint64_t received = 0;
+
+	while (late.read(entry))
+	{
+		CHECK(checkEntry(entry, n));
+		received++;
+	}
+
+	CHECK(received > 0);
+	CHECK(n == RING_TEST_ENTRIES - 1);
+
+	return true;
+}
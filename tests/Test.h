@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+
+// A failed check ends the test function with false.
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			return false; \
+		} \
+	} while (0)
+
+typedef bool (*TestFunction)();
+
+struct TestCase
+{
+	const char* name;
+	TestFunction function;
+};
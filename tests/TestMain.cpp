@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Test.h"
+
+bool testRecordFilterKernels();
+bool testRecordFilterSelect();
+bool testAwaitTimeouts();
+bool testLoadShedderRateLimit();
+bool testSharedRingLoad();
+bool testFastCodecRoundTrip();
+bool testPcapIndexQuery();
+bool testBatchQueueClose();
+bool testBroadcastRingRestart();
+bool testDeviceIdentityRebind();
+bool testFlightRecorderRecovery();
+bool testDeviceTrackerRetarget();
+
+bool benchRecordFilter();
+
+static const TestCase tests[] =
+{
+	{ "RecordFilter kernels", testRecordFilterKernels },
+	{ "RecordFilter select", testRecordFilterSelect },
+	{ "AwaitRegistry timeouts", testAwaitTimeouts },
+	{ "LoadShedder rate limit", testLoadShedderRateLimit },
+	{ "SharedRing load", testSharedRingLoad },
+	{ "FastCodec round trip", testFastCodecRoundTrip },
+	{ "PcapIndex query", testPcapIndexQuery },
+	{ "BatchQueue close", testBatchQueueClose },
+	{ "BroadcastRing restart", testBroadcastRingRestart },
+	{ "DeviceIdentityMap rebind", testDeviceIdentityRebind },
+	{ "FlightRecorder recovery", testFlightRecorderRecovery },
+	{ "DeviceTracker retarget", testDeviceTrackerRetarget },
+};
+
+static const TestCase benchmarks[] =
+{
+	{ "RecordFilter", benchRecordFilter },
+};
+
+// USBPcapHelperTests [--bench] [name]: runs the tests, or the benchmarks,
+// whose name starts with name. Exit code is the number of failures.
+int main(int argc, char* argv[])
+{
+	const TestCase* cases = tests;
+	size_t count = sizeof(tests) / sizeof(tests[0]);
+	const char* prefix = "";
+	int failed = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--bench") == 0)
+		{
+			cases = benchmarks;
+			count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+		}
+		else
+		{
+			prefix = argv[i];
+		}
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (strncmp(cases[i].name, prefix, strlen(prefix)) != 0)
+		{
+			continue;
+		}
+
+		bool passed = cases[i].function();
+		printf("[%s] %s\n", passed ? "PASS" : "FAIL", cases[i].name);
+
+		if (passed == false)
+		{
+			failed++;
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,84 @@
+#include <vector>
+
+#include "ControlTraffic.h"
+#include "DeviceTracker.h"
+#include "Test.h"
+
+// Returns the last candidate address the traffic suggested, 0 if none.
+static USHORT observe(DeviceTracker& tracker, ControlTraffic& traffic)
+{
+	std::vector<CaptureRecord> records;
+	RecordBatch batch = traffic.take(records);
+	USHORT found = 0;
+
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		USHORT candidate;
+
+		if (tracker.observe(batch.buffer, batch.records[i], candidate))
+		{
+			found = candidate;
+		}
+	}
+
+	return found;
+}
+
+// Only a complete device descriptor of the tracked VID/PID at another
+// address makes a candidate, a rejected one is quiet for a while.
+bool testDeviceTrackerRetarget()
+{
+	unsigned char descriptor[18] = { 18, 1, 0x00, 0x02, 0, 0, 0, 64, 0x34, 0x12, 0x78, 0x56, 0x00, 0x01, 1, 2, 3, 1 };
+	unsigned char other[18] = { 18, 1, 0x00, 0x02, 0, 0, 0, 64, 0x34, 0x12, 0x79, 0x56, 0x00, 0x01, 1, 2, 3, 1 };
+	ControlTraffic traffic(1);
+	DeviceTracker tracker;
+
+	tracker.setTarget(0x1234, 0x5678);
+	tracker.setAddress(5);
+	CHECK(tracker.getAddress() == 5);
+
+	traffic.setTime(100);
+
+	// the target's own traffic, the default address and other products
+	traffic.getDeviceDescriptor(5, 1, descriptor);
+	traffic.getDeviceDescriptor(0, 2, descriptor);
+	traffic.getDeviceDescriptor(8, 3, other);
+	CHECK(observe(tracker, traffic) == 0);
+
+	// the first 8 bytes drivers read before SET_ADDRESS
+	traffic.getDeviceDescriptor(9, 4, descriptor, 8);
+	CHECK(observe(tracker, traffic) == 0);
+
+	// a completion without its SETUP
+	traffic.complete(9, 5, descriptor, 18);
+	CHECK(observe(tracker, traffic) == 0);
+
+	traffic.getDeviceDescriptor(9, 6, descriptor);
+	CHECK(observe(tracker, traffic) == 9);
+
+	// the bus walk found another device of the same kind at 9
+	tracker.reject(9, pcapTimestampToNs(100, 0));
+
+	traffic.getDeviceDescriptor(9, 7, descriptor);
+	CHECK(observe(tracker, traffic) == 0);
+
+	traffic.setTime(100 + DEVICE_TRACKER_REJECT_TIME / NSEC_PER_SEC);
+	traffic.getDeviceDescriptor(9, 8, descriptor);
+	CHECK(observe(tracker, traffic) == 9);
+
+	// the target moved to 9, its old address is another device now
+	tracker.retarget(9);
+	CHECK(tracker.getAddress() == 9);
+
+	traffic.getDeviceDescriptor(9, 9, descriptor);
+	CHECK(observe(tracker, traffic) == 0);
+
+	traffic.getDeviceDescriptor(5, 10, descriptor);
+	CHECK(observe(tracker, traffic) == 5);
+
+	DeviceTrackerStats stats = tracker.getStats();
+	CHECK(stats.candidates == 3);
+	CHECK(stats.retargets == 1 && stats.rejects == 1);
+
+	return true;
+}